@@ -0,0 +1,515 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "branch_geometry.h"
+#include "branch_sway.h"
+#include "frame_arena.h"
+#include "framebuffer_backend.h"
+#include "rasterizer.h"
+#include "recording_backend.h"
+#include "scene.h"
+#include "seed_particles.h"
+#include "span_fill.h"
+#include "trig_tables.h"
+#include "view_transform.h"
+
+// Microbenchmarks selected with --bench-* on the command line. Each prints a
+// small table to stdout and returns false if a sanity check failed.
+
+inline double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Filled ellipses and convex polygons through each span writer. The shapes
+// mirror what the tree draws: leaf/petal/cloud/sun sized ellipses and the
+// 12-point seed outline at the scales drawSeed uses.
+inline bool benchmarkSpanFill()
+{
+    const int width = 800, height = 600;
+    const int ellipseFills = 400000;
+    const int polyFills = 100000;
+    const SpanFillKind kinds[] = {SpanFillKind::SCALAR, SpanFillKind::SSE2, SpanFillKind::AVX2};
+
+    std::vector<int> seedPolygons;
+    const int polyShapes = 16;
+    for (int shape = 0; shape < polyShapes; shape++)
+    {
+        double size = 8.0 * (1 + shape);
+        double angle = shape * 0.4;
+        for (int i = 0; i < 12; i++)
+        {
+            double t = i * 2 * 3.14159 / 12;
+            double localX = size * cos(t), localY = size * 0.5 * sin(t);
+            seedPolygons.push_back(400 + static_cast<int>(localX * cos(angle) - localY * sin(angle)));
+            seedPolygons.push_back(300 + static_cast<int>(localX * sin(angle) + localY * cos(angle)));
+        }
+    }
+
+    std::vector<Color> reference;
+    bool identical = true;
+
+    std::printf("%-8s %18s %18s\n", "impl", "ellipses/s", "polygons/s");
+    for (SpanFillKind kind : kinds)
+    {
+        if (!spanFillSupported(kind))
+        {
+            std::printf("%-8s %18s %18s\n", spanFillName(kind), "unsupported", "unsupported");
+            continue;
+        }
+
+        std::vector<Color> pixels(static_cast<size_t>(width) * height, 0);
+        Rasterizer raster;
+        raster.setTarget(pixels.data(), width, height);
+        raster.setSpanFill(kind);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ellipseFills; i++)
+        {
+            int radius = 3 + (i * 7) % 28;
+            raster.fillEllipse(40 + (i * 37) % 720, 40 + (i * 53) % 520, radius, radius, rgb(i & 255, 128, 64));
+        }
+        double ellipseSeconds = secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < polyFills; i++)
+        {
+            Color c = rgb(160, i & 255, 45);
+            raster.fillPoly(12, seedPolygons.data() + (i % polyShapes) * 24, c, c);
+        }
+        double polySeconds = secondsSince(start);
+
+        std::printf("%-8s %18.0f %18.0f\n", spanFillName(kind), ellipseFills / ellipseSeconds, polyFills / polySeconds);
+
+        if (reference.empty())
+            reference = pixels;
+        else if (reference != pixels)
+            identical = false;
+    }
+
+    if (!identical)
+        std::printf("mismatch: span writers produced different pixels\n");
+    return identical;
+}
+
+// `count` seeds kept falling across an 800x600 framebuffer at 60 fps: the
+// simulation ticks at 30 Hz, so every other frame steps the particles, and
+// every frame draws them. Landed seeds are topped up from the top of the
+// screen so the count stays level. Runs the tick with the scalar loop and
+// with SSE2, and checks both leave the seeds in the same place.
+inline bool benchmarkParticles(int count)
+{
+    const int width = 800, height = 600, frames = 240;
+    const float ground = 480.0f;
+    const int batch = 64; // seeds per emission point
+
+    FramebufferBackend framebuffer;
+    framebuffer.initialize(width, height, "");
+    FrameArena arena;
+    std::vector<float> reference;
+    bool identical = true;
+
+    std::printf("%-8s %8s %12s %12s %14s\n", "tick", "seeds", "ms/tick", "ms/draw", "ms/60fps frame");
+    for (int vectorized = 0; vectorized < 2; vectorized++)
+    {
+        SeedParticles seeds;
+        seeds.setVectorized(vectorized != 0);
+        seeds.reserve(count + batch);
+        unsigned int key = 0;
+        auto topUp = [&](bool anywhere) {
+            while (static_cast<int>(seeds.size()) < count)
+            {
+                float x = unitHash(7, key * 2) * width;
+                float y = anywhere ? unitHash(7, key * 2 + 1) * (ground - 10) : 0.0f;
+                seeds.emit(x, y, std::min(batch, count - static_cast<int>(seeds.size())), 1, key++);
+            }
+        };
+        topUp(true);
+
+        double tickSeconds = 0, drawSeconds = 0;
+        int ticks = 0;
+        long long drawn = 0;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            if (frame % 2 == 0)
+            {
+                auto start = std::chrono::steady_clock::now();
+                seeds.step(ground);
+                tickSeconds += secondsSince(start);
+                ticks++;
+                topUp(false);
+            }
+
+            framebuffer.beginFrame();
+            framebuffer.setBackground(rgb(135, 206, 235));
+            framebuffer.clear();
+            arena.reset();
+            auto start = std::chrono::steady_clock::now();
+            seeds.draw(framebuffer, arena, frame % 2 ? 0.5 : 0.0, 4, width, height, [](float x, float y, int &sx, int &sy) {
+                sx = static_cast<int>(x);
+                sy = static_cast<int>(y);
+            });
+            drawSeconds += secondsSince(start);
+            framebuffer.endFrame();
+            drawn += static_cast<long long>(seeds.size());
+        }
+
+        double tickMs = tickSeconds * 1000 / ticks, drawMs = drawSeconds * 1000 / frames;
+        std::printf("%-8s %8lld %12.3f %12.3f %14.3f\n", vectorized ? "sse2" : "scalar", drawn / frames, tickMs, drawMs,
+                    tickMs / 2 + drawMs);
+
+        std::vector<float> state(seeds.x);
+        state.insert(state.end(), seeds.y.begin(), seeds.y.end());
+        state.insert(state.end(), seeds.angle.begin(), seeds.angle.end());
+        if (reference.empty())
+            reference = state;
+        else if (reference != state)
+            identical = false;
+    }
+
+    if (!identical)
+        std::printf("mismatch: scalar and SSE2 ticks left the seeds in different places\n");
+    return identical;
+}
+
+// Present the frame `recording` holds `repeats` times in the order the scene
+// drew it and then state-sorted, with no scene logic, and check that both
+// leave exactly the pixels the recorded frame produced in `framebuffer`
+inline bool benchmarkReplay(RecordingBackend &recording, const FramebufferBackend &framebuffer, int repeats)
+{
+    unsigned long long expected = framebuffer.hash();
+    bool identical = true;
+
+    std::printf("%-10s %12s %14s %8s\n", "order", "ms/replay", "state calls", "pixels");
+    for (int sorted = 0; sorted < 2; sorted++)
+    {
+        int changes = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++)
+            changes = recording.replay(sorted != 0);
+        double ms = secondsSince(start) * 1000 / repeats;
+        bool same = framebuffer.hash() == expected;
+        identical = identical && same;
+        std::printf("%-10s %12.3f %14d %8s\n", sorted ? "sorted" : "recorded", ms, changes, same ? "same" : "DIFFER");
+    }
+    return identical;
+}
+
+// End points of an eight-level tree laid out as BranchGeometry does, once
+// with cos and sin of every branch's angle and once turning the parent's
+// Direction
+inline void branchEndsLibm(double x, double y, double length, double angle, int depth, std::vector<double> &ends)
+{
+    if (depth == 0)
+        return;
+    double ex = x + length * cos(angle), ey = y - length * sin(angle);
+    ends.push_back(ex);
+    ends.push_back(ey);
+    branchEndsLibm(ex, ey, length * 0.7, angle - 0.3, depth - 1, ends);
+    branchEndsLibm(ex, ey, length * 0.7, angle + 0.3, depth - 1, ends);
+    branchEndsLibm(ex, ey, length * 0.7 * 0.8, angle, depth - 1, ends);
+}
+
+inline void branchEndsTurned(double x, double y, double length, Direction direction, int depth, std::vector<double> &ends)
+{
+    if (depth == 0)
+        return;
+    double ex = x + length * direction.c, ey = y - length * direction.s;
+    ends.push_back(ex);
+    ends.push_back(ey);
+    branchEndsTurned(ex, ey, length * 0.7, direction.turned(BRANCH_LEFT), depth - 1, ends);
+    branchEndsTurned(ex, ey, length * 0.7, direction.turned(BRANCH_RIGHT), depth - 1, ends);
+    branchEndsTurned(ex, ey, length * 0.7 * 0.8, direction, depth - 1, ends);
+}
+
+// The compile-time trig tables and incremental branch rotation against
+// libm: time to lay out the tree at the 8x zoom (trunk 1200 px) and to
+// outline seeds both ways, and how far apart the results land. Fails if an
+// end point moves by half a pixel or more.
+inline bool benchmarkTrig()
+{
+    const int trees = 200, seeds = 200000;
+    const double angle = 3.14159 / 2;
+    std::vector<double> libmEnds, turnedEnds;
+    libmEnds.reserve(10000);
+    turnedEnds.reserve(10000);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < trees; i++)
+    {
+        libmEnds.clear();
+        branchEndsLibm(0, 0, 1200, angle, 8, libmEnds);
+    }
+    double libmTree = secondsSince(start) / trees;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < trees; i++)
+    {
+        turnedEnds.clear();
+        branchEndsTurned(0, 0, 1200, Direction{cos(angle), sin(angle)}, 8, turnedEnds);
+    }
+    double turnedTree = secondsSince(start) / trees;
+    double treeError = 0;
+    for (size_t i = 0; i < libmEnds.size(); i++)
+        treeError = std::max(treeError, std::fabs(libmEnds[i] - turnedEnds[i]));
+
+    // Seeds as drawSeed used to outline them, cos and sin for every point
+    auto libmSeed = [](int x, int y, double a, int size, int points[24]) {
+        for (int i = 0; i < 12; i++)
+        {
+            double t = i * 2 * 3.14159 / 12;
+            double localX = size * cos(t), localY = size * 0.5 * sin(t);
+            points[i * 2] = x + static_cast<int>(localX * cos(a) - localY * sin(a));
+            points[i * 2 + 1] = y + static_cast<int>(localX * sin(a) + localY * cos(a));
+        }
+    };
+    int points[24], line[4];
+    long long checksum = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < seeds; i++)
+    {
+        libmSeed(400, 300, i * 0.001, 8 + i % 56, points);
+        checksum += points[i % 24];
+    }
+    double libmSeedTime = secondsSince(start) / seeds;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < seeds; i++)
+    {
+        seedShape(400, 300, i * 0.001, 8 + i % 56, points, line);
+        checksum -= points[i % 24];
+    }
+    double tableSeedTime = secondsSince(start) / seeds;
+    // How far a table entry is from libm, scaled up to the biggest radius it
+    // is used at (seed size 63 here)
+    double tableError = 0;
+    for (int i = 0; i < 12; i++)
+    {
+        double t = i * 2 * 3.14159 / 12;
+        tableError = std::max(tableError, std::fabs(TWELVE_POINTS.cosines[i] - cos(t)));
+        tableError = std::max(tableError, std::fabs(TWELVE_POINTS.sines[i] - sin(t)));
+    }
+    for (int i = 0; i < 5; i++)
+    {
+        double t = i * 2 * 3.14159 / 5;
+        tableError = std::max(tableError, std::fabs(FLOWER_PETALS.cosines[i] - cos(t)));
+        tableError = std::max(tableError, std::fabs(FLOWER_PETALS.sines[i] - sin(t)));
+    }
+    double seedError = tableError * 63;
+
+    std::printf("%-14s %12s %12s %14s\n", "", "libm ns", "table ns", "max diff (px)");
+    std::printf("%-14s %12.0f %12.0f %14.2g\n", "tree layout", libmTree * 1e9, turnedTree * 1e9, treeError);
+    std::printf("%-14s %12.1f %12.1f %14.2g\n", "seed outline", libmSeedTime * 1e9, tableSeedTime * 1e9, seedError);
+    if (checksum == 1)
+        std::printf("\n"); // keeps the loops from being optimized away
+    return treeError < 0.5 && seedError < 0.5;
+}
+
+// Expanding each built-in species into BranchGeometry at every depth up to
+// 12 (or TreeGrammar::MAX_SEGMENTS), through its compile-time rules and
+// through the same grammar read at run time: segments, leaves, build time
+// and memory per tree. Fails if the two builds disagree.
+inline bool benchmarkGrammar()
+{
+    BranchGeometry fixed, runtime;
+    bool identical = true;
+
+    std::printf("%-6s %5s %10s %10s %12s %12s %10s\n", "tree", "depth", "segments", "leaves", "fixed ms", "runtime ms", "KB");
+    for (const TreeGrammar *species : SPECIES)
+    {
+        for (int depth = 1; depth <= 12 && species->segmentCount(depth) <= TreeGrammar::MAX_SEGMENTS; depth++)
+        {
+            int repeats = static_cast<int>(std::max(1LL, 2000000 / species->segmentCount(depth)));
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < repeats; i++)
+                fixed.build(*species, 1, 150, 3.14159 / 2, depth, 1.0, 1.0);
+            double fixedMs = secondsSince(start) * 1000 / repeats;
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < repeats; i++)
+                runtime.build(RuntimeRules{*species}, 1, 150, 3.14159 / 2, depth, 1.0, 1.0);
+            double runtimeMs = secondsSince(start) * 1000 / repeats;
+
+            identical = identical && fixed.x2 == runtime.x2 && fixed.y2 == runtime.y2 && fixed.subtreeEnd == runtime.subtreeEnd &&
+                        fixed.leafOffsetX == runtime.leafOffsetX;
+            std::printf("%-6s %5d %10zu %10zu %12.3f %12.3f %10.0f\n", species->name, depth, fixed.size(), fixed.leafCount(), fixedMs, runtimeMs,
+                        fixed.memoryBytes() / 1024.0);
+        }
+    }
+    if (!identical)
+        std::printf("compile-time and run-time rules built different trees\n");
+    return identical;
+}
+
+// BranchSway on the oak at depths 8, 10 and 12: time per segment to attach
+// the rest pose (once per build) and to sway it (every frame). Fails if
+// still air moves any end point by a thousandth of a pixel or more.
+inline bool benchmarkSway()
+{
+    BranchGeometry tree;
+    BranchSway sway;
+    bool still = true;
+
+    std::printf("%5s %10s %14s %14s %12s\n", "depth", "segments", "attach ns/seg", "sway ns/seg", "reach px");
+    for (int depth : {8, 10, 12})
+    {
+        tree.build(OAK, 1, 150, 3.14159 / 2, depth, 1.0, 1.0);
+        std::vector<float> restX2 = tree.x2, restY2 = tree.y2;
+        double segments = static_cast<double>(tree.size());
+        int repeats = static_cast<int>(std::max(1.0, 4000000 / segments));
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++)
+            sway.attach(tree, 400.0f);
+        double attachNs = secondsSince(start) * 1e9 / repeats / segments;
+
+        WindField calm;
+        sway.apply(tree, calm);
+        for (size_t i = 0; i < tree.size(); i++)
+            still = still && std::fabs(tree.x2[i] - restX2[i]) < 1e-3f && std::fabs(tree.y2[i] - restY2[i]) < 1e-3f;
+
+        WindField wind;
+        wind.strength = 1.0;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++)
+        {
+            wind.time = i / 30.0;
+            sway.apply(tree, wind);
+        }
+        double swayNs = secondsSince(start) * 1e9 / repeats / segments;
+        std::printf("%5d %10.0f %14.1f %14.1f %12.1f\n", depth, segments, attachNs, swayNs, tree.swayReach);
+    }
+    if (!still)
+        std::printf("still air moved the tree\n");
+    return still;
+}
+
+// The oak's branches at depths 8, 10 and 12 drawn into an 800x600
+// framebuffer the way drawBranchGeometry used to, one line() per segment
+// with colour and width set when they change, against one lines() call,
+// exact and anti-aliased. Checks the exact list gives the same pixels.
+inline bool benchmarkLines()
+{
+    const int width = 800, height = 600;
+    const Color wood = rgb(139, 69, 19), twig = rgb(34, 139, 34);
+    FramebufferBackend framebuffer;
+    framebuffer.initialize(width, height, "");
+    RenderBackend &target = framebuffer;
+    BranchGeometry tree;
+    std::vector<LineSegment> segments;
+    std::vector<int> screen;
+    bool identical = true;
+
+    std::printf("%5s %10s %14s %14s %14s\n", "depth", "segments", "line() ns/seg", "lines() ns/seg", "smooth ns/seg");
+    for (int depth : {8, 10, 12})
+    {
+        tree.build(OAK, 1, 150, 3.14159 / 2, depth, 1.0, 1.0);
+        int count = static_cast<int>(tree.size());
+        screen.resize(tree.size() * 4);
+        int *x1 = screen.data(), *y1 = x1 + count, *x2 = y1 + count, *y2 = x2 + count;
+        ViewTransform toScreen = ViewTransform::translate(width / 2, height - 50);
+        toScreen.map(tree.x1.data(), tree.y1.data(), tree.size(), x1, y1);
+        toScreen.map(tree.x2.data(), tree.y2.data(), tree.size(), x2, y2);
+        segments.clear();
+        for (int i = 0; i < count; i++)
+            segments.push_back({x1[i], y1[i], x2[i], y2[i], tree.thickness[i], tree.colorClass[i] == BranchGeometry::WOOD ? wood : twig});
+        int repeats = static_cast<int>(std::max(1.0, 2000000.0 / count));
+
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; r++)
+        {
+            target.beginFrame();
+            Color color = 0;
+            int thickness = -1;
+            for (const LineSegment &s : segments)
+            {
+                if (s.color != color)
+                    target.setColor(color = s.color);
+                if (s.thickness != thickness)
+                    target.setLineThickness(thickness = s.thickness);
+                target.line(s.x1, s.y1, s.x2, s.y2);
+            }
+            target.endFrame();
+        }
+        double lineNs = secondsSince(start) * 1e9 / repeats / count;
+        unsigned long long perCall = framebuffer.hash();
+
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; r++)
+        {
+            target.beginFrame();
+            target.lines(segments.data(), count, false);
+            target.endFrame();
+        }
+        double linesNs = secondsSince(start) * 1e9 / repeats / count;
+        identical = identical && framebuffer.hash() == perCall;
+
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; r++)
+        {
+            target.beginFrame();
+            target.lines(segments.data(), count, true);
+            target.endFrame();
+        }
+        double smoothNs = secondsSince(start) * 1e9 / repeats / count;
+        std::printf("%5d %10d %14.1f %14.1f %14.1f\n", depth, count, lineNs, linesNs, smoothNs);
+    }
+    if (!identical)
+        std::printf("mismatch: lines() drew different pixels from line()\n");
+    return identical;
+}
+
+// The scene's systems over growing skies of drifting clouds, with a sun for
+// every ten of them, into an 800x600 framebuffer: the update systems (orbits
+// and drift) and the render systems (suns and clouds), per entity. Both
+// should stay flat as the sky grows. Checks the life-cycle sky still puts
+// the clouds where drawClouds always had them.
+inline bool benchmarkScene()
+{
+    const int width = 800, height = 600;
+    FramebufferBackend framebuffer;
+    framebuffer.initialize(width, height, "");
+
+    Scene still = Scene::lifeCycle(width, 1, 3, 0.0f, 1, rgb(255, 255, 85), rgb(255, 255, 255));
+    still.updateDrift(10.0);
+    bool placed = !still.hasDrift();
+    for (int cloud = 0; cloud < 3; cloud++)
+    {
+        const Scene::Transform &t = still.transforms.get(1 + cloud);
+        placed = placed && t.x == 100 + cloud * 200 && t.y == 80 + (cloud * 17) % 50;
+    }
+
+    std::printf("%8s %8s %16s %16s\n", "clouds", "suns", "update ns/ent", "render ns/ent");
+    for (int clouds : {100, 1000, 10000, 100000})
+    {
+        int suns = clouds / 10;
+        Scene scene = Scene::lifeCycle(width, suns, clouds, 12.0f, 1, rgb(255, 255, 85), rgb(255, 255, 255));
+        double entities = scene.getEntityCount();
+        int repeats = std::max(1, 1000000 / clouds);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; r++)
+        {
+            scene.updateOrbits(r * 0.01);
+            scene.updateDrift(r / 30.0);
+        }
+        double updateNs = secondsSince(start) * 1e9 / repeats / entities;
+
+        int frames = std::max(1, 20000 / clouds);
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < frames; r++)
+        {
+            framebuffer.beginFrame();
+            scene.drawSuns(framebuffer);
+            scene.drawClouds(framebuffer, Scene::MAX_PUFFS);
+            framebuffer.endFrame();
+        }
+        double renderNs = secondsSince(start) * 1e9 / frames / entities;
+        std::printf("%8d %8d %16.1f %16.1f\n", clouds, suns, updateNs, renderNs);
+    }
+    if (!placed)
+        std::printf("mismatch: the life-cycle clouds moved\n");
+    return placed;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <graphics.h>
+
+#include "render_backend.h"
+
+// Forwards every call to WinBGI, flipping between pages 0 and 1
+class BgiBackend : public RenderBackend
+{
+private:
+    Color currentColor = 0;
+
+    static int toBgi(Color c)
+    {
+        return COLOR(colorRed(c), colorGreen(c), colorBlue(c));
+    }
+
+public:
+    void initialize(int width, int height, const char *title) override
+    {
+        initwindow(width, height, title);
+        setactivepage(0);
+        setvisualpage(0);
+    }
+
+    void shutdown() override { closegraph(); }
+
+    void beginFrame() override { setactivepage(1 - getactivepage()); }
+    void endFrame() override { setvisualpage(getactivepage()); }
+
+    void setColor(Color color) override
+    {
+        currentColor = color;
+        setcolor(toBgi(color));
+    }
+
+    Color getColor() const override { return currentColor; }
+    void setFillColor(Color color) override { setfillstyle(SOLID_FILL, toBgi(color)); }
+    void setLineThickness(int thickness) override { setlinestyle(SOLID_LINE, 0, thickness); }
+    void setBackground(Color color) override { setbkcolor(toBgi(color)); }
+    void setTextSize(int size) override { settextstyle(DEFAULT_FONT, HORIZ_DIR, size); }
+
+    void clear() override { cleardevice(); }
+    void line(int x1, int y1, int x2, int y2) override { ::line(x1, y1, x2, y2); }
+    void fillEllipse(int x, int y, int rx, int ry) override { fillellipse(x, y, rx, ry); }
+    void fillPoly(int numPoints, const int *points) override { fillpoly(numPoints, const_cast<int *>(points)); }
+    void bar(int left, int top, int right, int bottom) override { ::bar(left, top, right, bottom); }
+    void text(int x, int y, const char *str) override { outtextxy(x, y, const_cast<char *>(str)); }
+
+    int pollKey() override { return kbhit() ? getch() : -1; }
+    void delay(int ms) override { ::delay(ms); }
+};
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "hash.h"
+#include "tree_grammar.h"
+#include "trig_tables.h"
+
+// A TreeGrammar expanded into structure-of-arrays form. Segments are stored
+// in the order drawBranch visits them (pre-order), so walking the arrays
+// front to back reproduces the original painter's order.
+// Coordinates are float world units relative to the trunk base, and the tree
+// reaches the screen through a ViewTransform, so neither panning nor zooming
+// the camera forces a rebuild. Leaves are stored as pixel offsets from their
+// segment's end and line widths in pixels: zooming moves them but does not
+// scale them, as it always has.
+class BranchGeometry
+{
+public:
+    enum ColorClass : unsigned char
+    {
+        WOOD = 0, // depth > the grammar's twigLevels, drawn in BROWN
+        TWIG = 1  // the outer twigLevels levels (depth <= twigLevels), drawn in LEAF_GREEN
+    };
+
+    std::vector<float> x1, y1, x2, y2;
+    std::vector<int> thickness;
+    std::vector<unsigned char> depth;
+    std::vector<unsigned char> colorClass;
+    std::vector<unsigned char> flowerTip; // depth-1 tip far enough along to carry a flower
+    std::vector<unsigned char> grown;     // branchProgress has reached 1, so more growth no longer moves it
+    std::vector<int> leafStart;           // leaves of segment i are [leafStart[i], leafStart[i + 1])
+    std::vector<int> leafOffsetX, leafOffsetY, leafSize;
+
+    // Segment i and all of its descendants occupy [i, subtreeEnd[i]) and are
+    // covered by the box [boxLeft, boxRight] x [boxTop, boxBottom], which
+    // includes line width and leaves (but not flowers, whose size varies).
+    std::vector<int> subtreeEnd;
+    std::vector<float> boxLeft, boxTop, boxRight, boxBottom;
+
+    std::vector<int> parent; // segment each segment grows from, -1 for the trunk
+
+    // How far the end points may have been moved from where build() put
+    // them (by BranchSway); culling grows the boxes by this much
+    float swayReach = 0.0f;
+
+    // Rightmost depth-1 tip, used to place the seed that falls in phase 5
+    bool hasRightmostTip = false;
+    float rightmostTipX = 0.0f, rightmostTipY = 0.0f;
+
+private:
+    bool valid = false;
+    const TreeGrammar *keyGrammar = nullptr;
+    unsigned int keySeed = 0;
+    int keyTrunkLength = 0;
+    double keyAngle = 0.0;
+    int keyMaxDepth = 0;
+    int keyMaxLeaves = 3;
+    double keyScale = 0.0;
+    double keyGrowth = 0.0;
+    int buildCount = 0;
+
+    void growBox(int i, float left, float top, float right, float bottom)
+    {
+        boxLeft[i] = std::min(boxLeft[i], left);
+        boxTop[i] = std::min(boxTop[i], top);
+        boxRight[i] = std::max(boxRight[i], right);
+        boxBottom[i] = std::max(boxBottom[i], bottom);
+    }
+
+    // A branch waiting to be expanded, and the segment it grows from
+    struct Pending
+    {
+        float x, y;
+        double length;
+        Direction direction;
+        int level;
+        unsigned int branch;
+        int parent;
+    };
+    std::vector<Pending> pending; // branches still to expand, next one last
+
+    // Expand the grammar without recursion: branches wait on a stack and
+    // children are pushed last-first, so segments come out in the order a
+    // recursive walk would visit them. Boxes and subtree ranges are closed
+    // in one backward pass at the end, as every segment follows its parent.
+    template <typename Rules>
+    void generate(const Rules &rules, Direction trunk, int trunkLength, int maxDepth, double scale, double growthProgress)
+    {
+        const TreeGrammar &grammar = rules.grammar();
+        if (maxDepth <= 0 || scale <= 0.1)
+            return;
+        // Growth runs through the levels one tenth at a time, as it always
+        // has for the eight-level tree; deeper trees get more steps
+        double growthSteps = std::max(10, maxDepth + 2);
+
+        pending.push_back({0.0f, 0.0f, static_cast<double>(trunkLength), trunk, maxDepth, 0, -1});
+        while (!pending.empty())
+        {
+            Pending b = pending.back();
+            pending.pop_back();
+            int level = b.level;
+
+            double branchProgress = std::min(1.0, std::max(0.0, (growthProgress * growthSteps) - (maxDepth - level)));
+            if (branchProgress <= 0)
+                continue;
+
+            double scaledLength = b.length * scale * branchProgress;
+            float ex = b.x + static_cast<float>(scaledLength * b.direction.c);
+            float ey = b.y - static_cast<float>(scaledLength * b.direction.s);
+
+            if (level == 1 && (!hasRightmostTip || ex > rightmostTipX))
+            {
+                hasRightmostTip = true;
+                rightmostTipX = ex;
+                rightmostTipY = ey;
+            }
+
+            int index = static_cast<int>(size());
+            x1.push_back(b.x);
+            y1.push_back(b.y);
+            x2.push_back(ex);
+            y2.push_back(ey);
+            depth.push_back(static_cast<unsigned char>(level));
+            parent.push_back(b.parent);
+            if (level > grammar.twigLevels)
+            {
+                colorClass.push_back(WOOD);
+                thickness.push_back(static_cast<int>(level * scale) + 1);
+            }
+            else
+            {
+                colorClass.push_back(TWIG);
+                thickness.push_back(std::max(1, static_cast<int>(level * scale)));
+            }
+            flowerTip.push_back(level == 1 && scale > 0.8 && branchProgress > 0.9);
+            grown.push_back(branchProgress >= 1.0);
+
+            if (level <= grammar.leafLevels && scale > 0.5 && branchProgress > 0.8)
+            {
+                int numLeaves = std::min((level <= 3) ? 3 : 2, keyMaxLeaves);
+                for (int i = 0; i < numLeaves; i++)
+                {
+                    leafOffsetX.push_back(leafJitter(keySeed, b.branch, i, 0));
+                    leafOffsetY.push_back(leafJitter(keySeed, b.branch, i, 1));
+                    leafSize.push_back(static_cast<int>(4 * scale));
+                }
+            }
+            leafStart.push_back(static_cast<int>(leafOffsetX.size()));
+
+            float pad = static_cast<float>(thickness.back() / 2 + 1);
+            boxLeft.push_back(std::min(b.x, ex) - pad);
+            boxTop.push_back(std::min(b.y, ey) - pad);
+            boxRight.push_back(std::max(b.x, ex) + pad);
+            boxBottom.push_back(std::max(b.y, ey) + pad);
+            for (int leaf = leafStart[index]; leaf < leafStart[index + 1]; leaf++)
+            {
+                float reachX = static_cast<float>(std::abs(leafOffsetX[leaf]) + leafSize[leaf] + 1);
+                float reachY = static_cast<float>(std::abs(leafOffsetY[leaf]) + leafSize[leaf] + 1);
+                growBox(index, ex - reachX, ey - reachY, ex + reachX, ey + reachY);
+            }
+            subtreeEnd.push_back(index + 1);
+
+            if (level > 1)
+            {
+                for (int k = rules.childCount() - 1; k >= 0; k--)
+                {
+                    const TreeGrammar::Child &child = rules.child(k);
+                    pending.push_back({ex, ey, b.length * child.lengthFactor, b.direction.turned(child.turn), level - 1,
+                                       childBranch(b.branch, k, rules.childCount()), index});
+                }
+            }
+        }
+
+        for (int i = static_cast<int>(size()) - 1; i > 0; i--)
+        {
+            int p = parent[i];
+            subtreeEnd[p] = std::max(subtreeEnd[p], subtreeEnd[i]);
+            growBox(p, boxLeft[i], boxTop[i], boxRight[i], boxBottom[i]);
+        }
+    }
+
+public:
+    // Branches are numbered like a heap with `children` children per node:
+    // the trunk is 0 and child k of branch b is children * b + 1 + k (for the
+    // oak: 0 = left, 1 = right, 2 = straight on)
+    static unsigned int childBranch(unsigned int branch, int k, int children = 3) { return branch * children + 1 + k; }
+
+    // Offset in [-5, 4] of one coordinate of a leaf, the same range the old
+    // rand() % 10 - 5 gave, but a pure function of the seed and the leaf's
+    // place in the tree, so the same tree always grows the same leaves
+    static int leafJitter(unsigned int seed, unsigned int branch, int leaf, int axis)
+    {
+        unsigned int h = mixBits(seed * 0x9E3779B9u ^ (branch * 8 + leaf * 2 + axis));
+        return static_cast<int>(h % 10) - 5;
+    }
+
+    size_t size() const { return x1.size(); }
+    size_t leafCount() const { return leafOffsetX.size(); }
+
+    // Bytes the current tree takes up in the arrays (spare capacity and the
+    // build stack not counted)
+    size_t memoryBytes() const
+    {
+        size_t floats = x1.size() + y1.size() + x2.size() + y2.size() + boxLeft.size() + boxTop.size() + boxRight.size() + boxBottom.size();
+        size_t ints = thickness.size() + leafStart.size() + subtreeEnd.size() + parent.size() + leafOffsetX.size() + leafOffsetY.size() +
+                      leafSize.size();
+        size_t bytes = depth.size() + colorClass.size() + flowerTip.size() + grown.size();
+        return floats * sizeof(float) + ints * sizeof(int) + bytes;
+    }
+    int getBuildCount() const { return buildCount; }
+    void invalidate() { valid = false; }
+
+    bool matches(const TreeGrammar &grammar, unsigned int seed, int trunkLength, double angle, int maxDepth, double scale, double growth,
+                 int maxLeaves = 3) const
+    {
+        return valid && keyGrammar == &grammar && keySeed == seed && keyTrunkLength == trunkLength && keyAngle == angle && keyMaxDepth == maxDepth &&
+               keyScale == scale && keyGrowth == growth && keyMaxLeaves == maxLeaves;
+    }
+
+    // Regenerate the whole tree, `maxDepth` levels of `grammar` with at most
+    // maxLeaves leaves per branch end; buffers keep their capacity between
+    // builds. The built-in species go through their FixedRules.
+    void build(const TreeGrammar &grammar, unsigned int seed, int trunkLength, double angle, int maxDepth, double scale, double growth,
+               int maxLeaves = 3)
+    {
+        if (&grammar == &OAK)
+            build(FixedRules<OAK>(), seed, trunkLength, angle, maxDepth, scale, growth, maxLeaves);
+        else if (&grammar == &PINE)
+            build(FixedRules<PINE>(), seed, trunkLength, angle, maxDepth, scale, growth, maxLeaves);
+        else if (&grammar == &BIRCH)
+            build(FixedRules<BIRCH>(), seed, trunkLength, angle, maxDepth, scale, growth, maxLeaves);
+        else if (&grammar == &SHRUB)
+            build(FixedRules<SHRUB>(), seed, trunkLength, angle, maxDepth, scale, growth, maxLeaves);
+        else
+            build(RuntimeRules{grammar}, seed, trunkLength, angle, maxDepth, scale, growth, maxLeaves);
+    }
+
+    template <typename Rules>
+    void build(const Rules &rules, unsigned int seed, int trunkLength, double angle, int maxDepth, double scale, double growth, int maxLeaves = 3)
+    {
+        keyGrammar = &rules.grammar();
+        keySeed = seed;
+        keyMaxLeaves = maxLeaves;
+        x1.clear();
+        y1.clear();
+        x2.clear();
+        y2.clear();
+        thickness.clear();
+        depth.clear();
+        parent.clear();
+        colorClass.clear();
+        flowerTip.clear();
+        grown.clear();
+        leafStart.assign(1, 0);
+        leafOffsetX.clear();
+        leafOffsetY.clear();
+        leafSize.clear();
+        subtreeEnd.clear();
+        boxLeft.clear();
+        boxTop.clear();
+        boxRight.clear();
+        boxBottom.clear();
+        hasRightmostTip = false;
+        swayReach = 0.0f;
+
+        generate(rules, Direction{cos(angle), sin(angle)}, trunkLength, maxDepth, scale, growth);
+
+        valid = true;
+        keyTrunkLength = trunkLength;
+        keyAngle = angle;
+        keyMaxDepth = maxDepth;
+        keyScale = scale;
+        keyGrowth = growth;
+        buildCount++;
+    }
+};
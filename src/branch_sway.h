@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "branch_geometry.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Gusting wind: a steady lean plus a wave that travels to the right across
+// the land, so neighbouring trees bend one after the other. A twig one
+// pixel thick at world x turns by lean() + gust() * sin(phase() - k x)
+// radians, k being waveNumber().
+struct WindField
+{
+    static constexpr double PERIOD = 3.0;       // seconds between gusts at one spot
+    static constexpr double WAVELENGTH = 600.0; // world pixels between gusts at one time
+    static constexpr double TWIG_BEND = 0.08;   // radians at strength 1, half lean and half gust
+
+    double strength = 0.0;
+    double time = 0.0;
+
+    float lean() const { return static_cast<float>(strength * TWIG_BEND * 0.5); }
+    float gust() const { return static_cast<float>(strength * TWIG_BEND * 0.5); }
+    static double waveNumber() { return 2 * 3.14159 / WAVELENGTH; }
+    double phase() const { return 2 * 3.14159 * time / PERIOD; }
+};
+
+// Sways a built BranchGeometry in the wind. Each segment turns by its own
+// small angle, the wind's bend divided by its line width, so the trunk
+// barely moves and the twigs whip about; the turn carries everything above
+// it, so a segment's direction is its rest direction turned by itself and
+// all its ancestors.
+//
+// attach() sorts the segments by level, trunk first. Every segment of a
+// level depends only on the level before, so apply() runs through each
+// level four segments at a time (SSE2): gather the parents' end points and
+// rotations, add the segment's own turn, and place its end. The wind wave
+// sin(phase - k x) is sin(phase) cos(kx) - cos(phase) sin(kx), and cos(kx),
+// sin(kx) are worked out at attach(), so apply() costs no trig per segment.
+// attach() costs several times what apply() does, so a geometry rebuilt
+// unchanged should keep its BranchSway attached rather than attach again.
+// The results are written back into the geometry's end points in painter's
+// order, and its sway reach is set so culling allows for the movement.
+class BranchSway
+{
+private:
+    const BranchGeometry *attached = nullptr;
+    int attachedBuild = -1;
+
+    // By level, trunk first; slot j is segment order[j] of the geometry
+    std::vector<int> order;
+    std::vector<int> parentSlot; // slot of the parent; the trunk's is its own
+    std::vector<float> restX, restY;   // segment vector at rest
+    std::vector<float> restEndX, restEndY;
+    std::vector<float> flex;           // 1 / line width
+    std::vector<float> waveC, waveS;   // cos and sin of the wave number times x
+    std::vector<int> levelStart;       // slots of level group g are [levelStart[g], levelStart[g + 1])
+    float rootX = 0.0f, rootY = 0.0f;
+
+    // Working state of the last apply(), by slot
+    std::vector<float> endX, endY, rotC, rotS;
+
+    // attach()'s scratch: slot of each segment, next free slot of each level
+    std::vector<int> slotOf, nextSlot;
+
+    long long segmentsSwayed = 0;
+
+    // Turn of slot j and where that leaves its end, from its parent's
+    // rotation (pc, ps) and end (px, py). The same float operations as the
+    // SSE2 path, in the same order.
+    void swayOne(int j, float sinPhase, float cosPhase, float lean, float gust, float px, float py, float pc, float ps)
+    {
+        float wave = sinPhase * waveC[j] - cosPhase * waveS[j];
+        float theta = flex[j] * (lean + gust * wave);
+        float theta2 = theta * theta;
+        float c = 1.0f - theta2 * (0.5f - theta2 * (1.0f / 24.0f));
+        float s = theta * (1.0f - theta2 * (1.0f / 6.0f));
+        float rc = pc * c - ps * s;
+        float rs = ps * c + pc * s;
+        rotC[j] = rc;
+        rotS[j] = rs;
+        endX[j] = px + (rc * restX[j] - rs * restY[j]);
+        endY[j] = py + (rs * restX[j] + rc * restY[j]);
+    }
+
+public:
+    bool isAttachedTo(const BranchGeometry &tree) const { return attached == &tree && attachedBuild == tree.getBuildCount(); }
+
+    // Take the geometry as it has just been built as the rest pose. baseX is
+    // where its trunk stands in the wind field.
+    void attach(const BranchGeometry &tree, float baseX)
+    {
+        attached = &tree;
+        attachedBuild = tree.getBuildCount();
+        int count = static_cast<int>(tree.size());
+        order.resize(count);
+        parentSlot.resize(count);
+        restX.resize(count);
+        restY.resize(count);
+        restEndX.resize(count);
+        restEndY.resize(count);
+        flex.resize(count);
+        waveC.resize(count);
+        waveS.resize(count);
+        endX.resize(count);
+        endY.resize(count);
+        rotC.resize(count);
+        rotS.resize(count);
+        levelStart.clear();
+        if (count == 0)
+            return;
+
+        // Counting sort by level, highest (the trunk) first; pre-order keeps
+        // each level in painter's order
+        int top = tree.depth[0];
+        levelStart.assign(top + 2, 0);
+        for (int i = 0; i < count; i++)
+            levelStart[top - tree.depth[i] + 1]++;
+        for (int g = 1; g <= top + 1; g++)
+            levelStart[g] += levelStart[g - 1];
+        slotOf.resize(count);
+        nextSlot.assign(levelStart.begin(), levelStart.end() - 1);
+        for (int i = 0; i < count; i++)
+        {
+            int j = nextSlot[top - tree.depth[i]]++;
+            order[j] = i;
+            slotOf[i] = j;
+        }
+
+        double k = WindField::waveNumber();
+        for (int j = 0; j < count; j++)
+        {
+            int i = order[j];
+            parentSlot[j] = tree.parent[i] >= 0 ? slotOf[tree.parent[i]] : j;
+            restX[j] = tree.x2[i] - tree.x1[i];
+            restY[j] = tree.y2[i] - tree.y1[i];
+            restEndX[j] = tree.x2[i];
+            restEndY[j] = tree.y2[i];
+            flex[j] = 1.0f / static_cast<float>(std::max(1, tree.thickness[i]));
+            double x = baseX + tree.x1[i];
+            waveC[j] = static_cast<float>(std::cos(k * x));
+            waveS[j] = static_cast<float>(std::sin(k * x));
+        }
+        rootX = tree.x1[0];
+        rootY = tree.y1[0];
+    }
+
+    // Bend the attached geometry, which must be `tree` or an identical
+    // rebuild of it, for the wind now
+    void apply(BranchGeometry &tree, const WindField &wind)
+    {
+        int count = static_cast<int>(order.size());
+        if (count == 0)
+            return;
+        float sinPhase = static_cast<float>(std::sin(wind.phase()));
+        float cosPhase = static_cast<float>(std::cos(wind.phase()));
+        float lean = wind.lean(), gust = wind.gust();
+
+        // The trunk turns about its base
+        swayOne(0, sinPhase, cosPhase, lean, gust, rootX, rootY, 1.0f, 0.0f);
+        for (int g = 1; g + 1 < static_cast<int>(levelStart.size()); g++)
+        {
+            int j = levelStart[g], end = levelStart[g + 1];
+#ifdef __SSE2__
+            const __m128 vSin = _mm_set1_ps(sinPhase), vCos = _mm_set1_ps(cosPhase);
+            const __m128 vLean = _mm_set1_ps(lean), vGust = _mm_set1_ps(gust);
+            const __m128 one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f);
+            const __m128 sixth = _mm_set1_ps(1.0f / 6.0f), twentyFourth = _mm_set1_ps(1.0f / 24.0f);
+            for (; j + 4 <= end; j += 4)
+            {
+                const int *p = &parentSlot[j];
+                __m128 px = _mm_setr_ps(endX[p[0]], endX[p[1]], endX[p[2]], endX[p[3]]);
+                __m128 py = _mm_setr_ps(endY[p[0]], endY[p[1]], endY[p[2]], endY[p[3]]);
+                __m128 pc = _mm_setr_ps(rotC[p[0]], rotC[p[1]], rotC[p[2]], rotC[p[3]]);
+                __m128 ps = _mm_setr_ps(rotS[p[0]], rotS[p[1]], rotS[p[2]], rotS[p[3]]);
+
+                __m128 wave = _mm_sub_ps(_mm_mul_ps(vSin, _mm_loadu_ps(&waveC[j])), _mm_mul_ps(vCos, _mm_loadu_ps(&waveS[j])));
+                __m128 theta = _mm_mul_ps(_mm_loadu_ps(&flex[j]), _mm_add_ps(vLean, _mm_mul_ps(vGust, wave)));
+                __m128 theta2 = _mm_mul_ps(theta, theta);
+                __m128 c = _mm_sub_ps(one, _mm_mul_ps(theta2, _mm_sub_ps(half, _mm_mul_ps(theta2, twentyFourth))));
+                __m128 s = _mm_mul_ps(theta, _mm_sub_ps(one, _mm_mul_ps(theta2, sixth)));
+                __m128 rc = _mm_sub_ps(_mm_mul_ps(pc, c), _mm_mul_ps(ps, s));
+                __m128 rs = _mm_add_ps(_mm_mul_ps(ps, c), _mm_mul_ps(pc, s));
+                __m128 rx = _mm_loadu_ps(&restX[j]), ry = _mm_loadu_ps(&restY[j]);
+                _mm_storeu_ps(&rotC[j], rc);
+                _mm_storeu_ps(&rotS[j], rs);
+                _mm_storeu_ps(&endX[j], _mm_add_ps(px, _mm_sub_ps(_mm_mul_ps(rc, rx), _mm_mul_ps(rs, ry))));
+                _mm_storeu_ps(&endY[j], _mm_add_ps(py, _mm_add_ps(_mm_mul_ps(rs, rx), _mm_mul_ps(rc, ry))));
+            }
+#endif
+            for (; j < end; j++)
+            {
+                int p = parentSlot[j];
+                swayOne(j, sinPhase, cosPhase, lean, gust, endX[p], endY[p], rotC[p], rotS[p]);
+            }
+        }
+
+        // Back into painter's order, noting how far anything moved
+        float reach = 0.0f;
+        for (int j = 0; j < count; j++)
+        {
+            int i = order[j], p = parentSlot[j];
+            tree.x1[i] = j == 0 ? rootX : endX[p];
+            tree.y1[i] = j == 0 ? rootY : endY[p];
+            tree.x2[i] = endX[j];
+            tree.y2[i] = endY[j];
+            reach = std::max(reach, std::max(std::fabs(endX[j] - restEndX[j]), std::fabs(endY[j] - restEndY[j])));
+        }
+        tree.swayReach = reach + 1.0f;
+        segmentsSwayed += count;
+    }
+
+    long long getSegmentsSwayed() const { return segmentsSwayed; }
+};
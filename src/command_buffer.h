@@ -0,0 +1,350 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "rasterizer.h"
+#include "render_backend.h"
+
+// One recorded primitive with the state it was issued under already resolved
+// (the colour it will be drawn in, the line width) and its screen bounds.
+struct DrawCommand
+{
+    enum Type : unsigned char
+    {
+        CLEAR,
+        LINE,
+        SMOOTH_LINE,
+        FILL_ELLIPSE,
+        FILL_POLY,
+        BAR,
+        TEXT,
+        STAMPS
+    };
+
+    Type type;
+    Color color;   // line / fill / text / background colour
+    Color outline; // fillpoly border
+    int a, b, c, d; // coordinates, meaning depends on type; STAMPS: a is the stamp index
+    int size;      // line width or text size
+    int data;      // FILL_POLY / TEXT / STAMPS: offset into points / chars / points
+    int count;     // FILL_POLY / STAMPS: number of points
+    ClipRect bounds;
+};
+
+// A frame's worth of draw commands, replayable into any clip rectangle or
+// into another backend. Storage is reused from frame to frame.
+class CommandBuffer
+{
+private:
+    std::vector<DrawCommand> commands;
+    std::vector<int> points;
+    std::vector<char> chars;
+    std::vector<Stamp> stampCopies; // only the first stampCount are this frame's
+    int stampCount = 0;
+    int width = 0, height = 0;
+
+    // Replay order from sortByState: commands grouped into batches that share
+    // backend state, each batch a list through nextInBatch. tileBatch holds,
+    // for every SORT_TILE square of the screen, the last batch drawing there.
+    static const int SORT_TILE = 8;
+    struct Batch
+    {
+        int head, tail;
+    };
+    std::vector<Batch> batches;
+    std::vector<int> nextInBatch;
+    std::vector<int> order;
+    std::vector<int> tileBatch;
+    int sortTilesX = 0, sortTilesY = 0;
+
+    void push(const DrawCommand &cmd) { commands.push_back(cmd); }
+
+    // Whether a and b are drawn under the same backend state: ellipses and
+    // bars only use the fill colour, stamps carry their own colours
+    static bool sameState(const DrawCommand &a, const DrawCommand &b)
+    {
+        auto kind = [](DrawCommand::Type type) { return type == DrawCommand::BAR ? DrawCommand::FILL_ELLIPSE : type; };
+        if (kind(a.type) != kind(b.type) || a.color != b.color || a.outline != b.outline)
+            return false;
+        bool sized = a.type == DrawCommand::LINE || a.type == DrawCommand::SMOOTH_LINE || a.type == DrawCommand::TEXT;
+        return !sized || a.size == b.size;
+    }
+
+    // Tiles of the sort grid covered by box, as [tx0, tx1) x [ty0, ty1);
+    // false if it is entirely off screen
+    bool tileRange(const ClipRect &box, int &tx0, int &ty0, int &tx1, int &ty1) const
+    {
+        int left = std::max(box.left, 0), top = std::max(box.top, 0);
+        int right = std::min(box.right, width), bottom = std::min(box.bottom, height);
+        if (left >= right || top >= bottom)
+            return false;
+        tx0 = left / SORT_TILE;
+        ty0 = top / SORT_TILE;
+        tx1 = (right - 1) / SORT_TILE + 1;
+        ty1 = (bottom - 1) / SORT_TILE + 1;
+        return true;
+    }
+
+public:
+    void reset(int screenWidth, int screenHeight)
+    {
+        commands.clear();
+        points.clear();
+        chars.clear();
+        order.clear();
+        stampCount = 0;
+        width = screenWidth;
+        height = screenHeight;
+    }
+
+    size_t size() const { return commands.size(); }
+    size_t getBatchCount() const { return batches.size(); }
+    const DrawCommand &operator[](size_t i) const { return commands[i]; }
+
+    void clear(Color background)
+    {
+        push({DrawCommand::CLEAR, background, 0, 0, 0, 0, 0, 0, 0, 0, {0, 0, width, height}});
+    }
+
+    void line(int x1, int y1, int x2, int y2, int thickness, Color color)
+    {
+        push({DrawCommand::LINE, color, 0, x1, y1, x2, y2, thickness, 0, 0, Rasterizer::lineBounds(x1, y1, x2, y2, thickness)});
+    }
+
+    // One command per segment, so each is binned by its own bounds
+    void lines(const LineSegment *segments, int count, bool antialias)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            const LineSegment &s = segments[i];
+            if (antialias)
+            {
+                push({DrawCommand::SMOOTH_LINE, s.color, 0, s.x1, s.y1, s.x2, s.y2, s.thickness, 0, 0,
+                      Rasterizer::smoothLineBounds(s.x1, s.y1, s.x2, s.y2, s.thickness)});
+            }
+            else
+            {
+                line(s.x1, s.y1, s.x2, s.y2, s.thickness, s.color);
+            }
+        }
+    }
+
+    void fillEllipse(int x, int y, int rx, int ry, Color color)
+    {
+        if (rx < 0 || ry < 0)
+            return;
+        push({DrawCommand::FILL_ELLIPSE, color, 0, x, y, rx, ry, 0, 0, 0, Rasterizer::ellipseBounds(x, y, rx, ry)});
+    }
+
+    void fillPoly(int numPoints, const int *pts, Color fill, Color outline)
+    {
+        if (numPoints < 2)
+            return;
+        ClipRect box = Rasterizer::polyBounds(numPoints, pts);
+        int offset = static_cast<int>(points.size());
+        points.insert(points.end(), pts, pts + numPoints * 2);
+        push({DrawCommand::FILL_POLY, fill, outline, 0, 0, 0, 0, 0, offset, numPoints, box});
+    }
+
+    void bar(int left, int top, int right, int bottom, Color color)
+    {
+        push({DrawCommand::BAR, color, 0, left, top, right, bottom, 0, 0, 0, Rasterizer::barBounds(left, top, right, bottom)});
+    }
+
+    void text(int x, int y, const char *str, int size, Color color)
+    {
+        int length = static_cast<int>(std::strlen(str));
+        int offset = static_cast<int>(chars.size());
+        chars.insert(chars.end(), str, str + length + 1);
+        push({DrawCommand::TEXT, color, 0, x, y, 0, 0, size, offset, length, Rasterizer::textBounds(x, y, length, size)});
+    }
+
+    // The stamp is copied (into storage kept from earlier frames), so the
+    // caller may change it before the buffer is replayed
+    void stamps(const Stamp &stamp, int count, const int *positions)
+    {
+        if (count <= 0)
+            return;
+        if (stampCount == static_cast<int>(stampCopies.size()))
+            stampCopies.emplace_back();
+        Stamp &copy = stampCopies[stampCount];
+        copy.spans.assign(stamp.spans.begin(), stamp.spans.end());
+        copy.left = stamp.left;
+        copy.top = stamp.top;
+        copy.right = stamp.right;
+        copy.bottom = stamp.bottom;
+        int offset = static_cast<int>(points.size());
+        points.insert(points.end(), positions, positions + count * 2);
+        push({DrawCommand::STAMPS, 0, 0, stampCount++, 0, 0, 0, 0, offset, count, Rasterizer::stampBounds(stamp, count, positions)});
+    }
+
+    // Rasterize command i through whatever clip rectangle raster currently has
+    void execute(size_t i, Rasterizer &raster) const
+    {
+        const DrawCommand &cmd = commands[i];
+        switch (cmd.type)
+        {
+        case DrawCommand::CLEAR:
+            raster.bar(0, 0, width - 1, height - 1, cmd.color);
+            break;
+        case DrawCommand::LINE:
+            raster.line(cmd.a, cmd.b, cmd.c, cmd.d, cmd.size, cmd.color);
+            break;
+        case DrawCommand::SMOOTH_LINE:
+            raster.smoothLine(cmd.a, cmd.b, cmd.c, cmd.d, cmd.size, cmd.color);
+            break;
+        case DrawCommand::FILL_ELLIPSE:
+            raster.fillEllipse(cmd.a, cmd.b, cmd.c, cmd.d, cmd.color);
+            break;
+        case DrawCommand::FILL_POLY:
+            raster.fillPoly(cmd.count, points.data() + cmd.data, cmd.color, cmd.outline);
+            break;
+        case DrawCommand::BAR:
+            raster.bar(cmd.a, cmd.b, cmd.c, cmd.d, cmd.color);
+            break;
+        case DrawCommand::TEXT:
+            raster.text(cmd.a, cmd.b, chars.data() + cmd.data, cmd.size, cmd.color);
+            break;
+        case DrawCommand::STAMPS:
+            raster.stamps(stampCopies[cmd.a], cmd.count, points.data() + cmd.data);
+            break;
+        }
+    }
+
+    // Reorder the commands for replay so that runs share colour and width.
+    // A command joins the latest batch with its state (among the last
+    // `lookback`) unless a later batch has drawn in one of the screen tiles
+    // it covers, in which case it starts a new batch. So it only ever moves
+    // ahead of commands it does not touch, and within a batch the recorded
+    // order is kept, which leaves every pixel as recorded.
+    void sortByState(int lookback = 64)
+    {
+        sortTilesX = (width + SORT_TILE - 1) / SORT_TILE;
+        sortTilesY = (height + SORT_TILE - 1) / SORT_TILE;
+        tileBatch.assign(static_cast<size_t>(sortTilesX) * sortTilesY, -1);
+        batches.clear();
+        nextInBatch.assign(commands.size(), -1);
+        for (size_t i = 0; i < commands.size(); i++)
+        {
+            const DrawCommand &cmd = commands[i];
+            int tx0 = 0, ty0 = 0, tx1 = 0, ty1 = 0;
+            bool onScreen = tileRange(cmd.bounds, tx0, ty0, tx1, ty1);
+
+            int found = -1;
+            int last = static_cast<int>(batches.size()) - 1;
+            for (int b = last; b >= 0 && b > last - lookback; b--)
+            {
+                if (sameState(commands[batches[b].head], cmd))
+                {
+                    found = b;
+                    break;
+                }
+            }
+            for (int ty = ty0; onScreen && found >= 0 && ty < ty1; ty++)
+                for (int tx = tx0; tx < tx1; tx++)
+                    if (tileBatch[ty * sortTilesX + tx] > found)
+                    {
+                        found = -1;
+                        break;
+                    }
+
+            if (found < 0)
+            {
+                found = static_cast<int>(batches.size());
+                batches.push_back({static_cast<int>(i), static_cast<int>(i)});
+            }
+            else
+            {
+                nextInBatch[batches[found].tail] = static_cast<int>(i);
+                batches[found].tail = static_cast<int>(i);
+            }
+            for (int ty = ty0; onScreen && ty < ty1; ty++)
+                for (int tx = tx0; tx < tx1; tx++)
+                    tileBatch[ty * sortTilesX + tx] = std::max(tileBatch[ty * sortTilesX + tx], found);
+        }
+
+        order.clear();
+        for (const Batch &batch : batches)
+            for (int i = batch.head; i >= 0; i = nextInBatch[i])
+                order.push_back(i);
+    }
+
+    // Draw the frame into target, in sortByState order if `sorted` and it has
+    // been sorted since the last reset, setting colour, width and text size
+    // only when they change. Returns the number of state calls made.
+    int replay(RenderBackend &target, bool sorted = true) const
+    {
+        sorted = sorted && order.size() == commands.size();
+        bool colorSet = false, fillSet = false, backgroundSet = false, thicknessSet = false, textSizeSet = false;
+        Color color = 0, fill = 0, background = 0;
+        int thickness = 0, textSize = 0;
+        int changes = 0;
+        auto update = [&changes](bool &known, auto &current, auto value) {
+            bool changed = !known || current != value;
+            known = true;
+            current = value;
+            changes += changed;
+            return changed;
+        };
+
+        for (size_t k = 0; k < commands.size(); k++)
+        {
+            const DrawCommand &cmd = commands[sorted ? order[k] : k];
+            switch (cmd.type)
+            {
+            case DrawCommand::CLEAR:
+                if (update(backgroundSet, background, cmd.color))
+                    target.setBackground(background);
+                target.clear();
+                break;
+            case DrawCommand::LINE:
+                if (update(colorSet, color, cmd.color))
+                    target.setColor(color);
+                if (update(thicknessSet, thickness, cmd.size))
+                    target.setLineThickness(thickness);
+                target.line(cmd.a, cmd.b, cmd.c, cmd.d);
+                break;
+            case DrawCommand::SMOOTH_LINE:
+            {
+                // Carries its own colour and width, and leaves them set
+                LineSegment segment = {cmd.a, cmd.b, cmd.c, cmd.d, cmd.size, cmd.color};
+                target.lines(&segment, 1, true);
+                colorSet = thicknessSet = true;
+                color = cmd.color;
+                thickness = cmd.size;
+                break;
+            }
+            case DrawCommand::FILL_ELLIPSE:
+            case DrawCommand::BAR:
+                if (update(fillSet, fill, cmd.color))
+                    target.setFillColor(fill);
+                if (cmd.type == DrawCommand::BAR)
+                    target.bar(cmd.a, cmd.b, cmd.c, cmd.d);
+                else
+                    target.fillEllipse(cmd.a, cmd.b, cmd.c, cmd.d);
+                break;
+            case DrawCommand::FILL_POLY:
+                if (update(fillSet, fill, cmd.color))
+                    target.setFillColor(fill);
+                if (update(colorSet, color, cmd.outline))
+                    target.setColor(color);
+                target.fillPoly(cmd.count, points.data() + cmd.data);
+                break;
+            case DrawCommand::TEXT:
+                if (update(colorSet, color, cmd.color))
+                    target.setColor(color);
+                if (update(textSizeSet, textSize, cmd.size))
+                    target.setTextSize(textSize);
+                target.text(cmd.a, cmd.b, chars.data() + cmd.data);
+                break;
+            case DrawCommand::STAMPS:
+                target.stamps(stampCopies[cmd.a], cmd.count, points.data() + cmd.data);
+                fillSet = false; // the default stamps() leaves its own fill colour
+                break;
+            }
+        }
+        return changes;
+    }
+};
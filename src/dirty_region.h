@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "rasterizer.h"
+
+// Screen area touched by drawing, tracked as a grid of 16x16 pixel tiles
+class DirtyRegion
+{
+private:
+    static const int TILE = 16;
+    int width = 0, height = 0;
+    int cols = 0, rows = 0;
+    std::vector<unsigned char> tiles;
+
+public:
+    void resize(int w, int h)
+    {
+        width = w;
+        height = h;
+        cols = (w + TILE - 1) / TILE;
+        rows = (h + TILE - 1) / TILE;
+        tiles.assign(static_cast<size_t>(cols) * rows, 0);
+    }
+
+    void clear() { std::fill(tiles.begin(), tiles.end(), 0); }
+    void markAll() { std::fill(tiles.begin(), tiles.end(), 1); }
+    void swap(DirtyRegion &other) { tiles.swap(other.tiles); }
+
+    void mark(const ClipRect &box)
+    {
+        int left = std::max(box.left, 0), top = std::max(box.top, 0);
+        int right = std::min(box.right, width), bottom = std::min(box.bottom, height);
+        if (left >= right || top >= bottom)
+            return;
+        for (int ty = top / TILE; ty <= (bottom - 1) / TILE; ty++)
+            std::fill(tiles.begin() + ty * cols + left / TILE, tiles.begin() + ty * cols + (right - 1) / TILE + 1, 1);
+    }
+
+    // Call f(rect) for each horizontal run of dirty tiles
+    template <typename F>
+    void forEachRun(F f) const
+    {
+        for (int ty = 0; ty < rows; ty++)
+        {
+            const unsigned char *row = tiles.data() + ty * cols;
+            for (int tx = 0; tx < cols;)
+            {
+                if (!row[tx])
+                {
+                    tx++;
+                    continue;
+                }
+                int start = tx;
+                while (tx < cols && row[tx])
+                    tx++;
+                f(ClipRect{start * TILE, ty * TILE, std::min(tx * TILE, width), std::min((ty + 1) * TILE, height)});
+            }
+        }
+    }
+};
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "hash.h"
+#include "rasterizer.h"
+#include "render_backend.h"
+
+// A strip of land `worldWidth` pixels wide (it wraps around) with many trees,
+// each going through its own grow / flower / fade cycle from its own offset
+// and with its own leaf seed. Trees stand in ROWS rows from the horizon (row
+// 0, smallest) to the front (row ROWS - 1, full size); rows are drawn back
+// to front and each row is sorted by x, so only the trees near the camera
+// are ever looked at.
+//
+// How a tree is drawn depends on how big it is on screen: big trees get the
+// full eight levels of branches, middling ones fewer levels, and small ones
+// an impostor, a pre-rendered sprite of a tree at that size and a nearby
+// growth stage, shared by every tree that looks about the same.
+class Forest
+{
+public:
+    static const int ROWS = 6;
+    static const int GROWTH_STEPS = 16; // growth stages an impostor is rendered at
+    static const int FLOWER_STEPS = 4;  // flower sizes, from none to full
+    static const int VARIANTS = 4;      // leaf seeds impostors are rendered with
+    static constexpr double CYCLE_SECONDS = 40.0;
+    static constexpr double FULL_TRUNK = 120.0;    // trunk pixels from which every level of the species is drawn
+    static constexpr double IMPOSTOR_TRUNK = 40.0; // trunk pixels below which an impostor is drawn
+    static const int REDUCED_DEPTH = 6;            // levels drawn below that, at most
+
+    enum Detail
+    {
+        FULL,
+        REDUCED,
+        IMPOSTOR
+    };
+
+    struct Tree
+    {
+        float x;
+        float cycleOffset; // where in its cycle the tree is at time 0, in [0, 1)
+        float cycleSpeed;  // cycles per CYCLE_SECONDS
+        unsigned int seed;
+        int index; // 0 to size() - 1, row by row, for per-tree state kept elsewhere
+    };
+
+    // A tree as it stands at one moment
+    struct TreeView
+    {
+        const Tree *tree;
+        int screenX;
+        double growth, flowerScale;
+    };
+
+private:
+    float worldWidth;
+    std::vector<std::vector<Tree>> rows;
+    std::vector<Stamp> impostors;
+    std::vector<unsigned char> impostorBuilt;
+    int impostorsBuilt = 0;
+
+public:
+    Forest(int treeCount, float width, unsigned int seed) : worldWidth(width), rows(ROWS)
+    {
+        for (int i = 0; i < treeCount; i++)
+        {
+            unsigned int key = static_cast<unsigned int>(i) * 4u;
+            // Cubing puts most trees in the back rows, where they are small
+            float depth = unitHash(seed, key);
+            int row = std::min(ROWS - 1, static_cast<int>(depth * depth * depth * ROWS));
+            Tree tree;
+            tree.x = unitHash(seed, key + 1) * worldWidth;
+            tree.cycleOffset = unitHash(seed, key + 2);
+            tree.cycleSpeed = 0.8f + 0.4f * unitHash(seed, key + 3);
+            tree.seed = mixBits(seed + static_cast<unsigned int>(i));
+            rows[row].push_back(tree);
+        }
+        int index = 0;
+        for (std::vector<Tree> &row : rows)
+        {
+            std::sort(row.begin(), row.end(), [](const Tree &a, const Tree &b) { return a.x < b.x; });
+            for (Tree &tree : row)
+                tree.index = index++;
+        }
+
+        impostors.resize(ROWS * GROWTH_STEPS * FLOWER_STEPS * VARIANTS);
+        impostorBuilt.assign(impostors.size(), 0);
+    }
+
+    size_t size() const
+    {
+        size_t total = 0;
+        for (const std::vector<Tree> &row : rows)
+            total += row.size();
+        return total;
+    }
+    float getWorldWidth() const { return worldWidth; }
+    int getImpostorsBuilt() const { return impostorsBuilt; }
+
+    // Size of a row's trees relative to the single tree, and where their trunks stand
+    static double rowScale(int row)
+    {
+        double t = (row + 1.0) / ROWS;
+        return 0.12 + 0.88 * t * t;
+    }
+    static int rowBase(int row, int groundY, int screenHeight)
+    {
+        return groundY + 4 + (screenHeight - groundY - 16) * row / (ROWS - 1);
+    }
+
+    // Growth and flower size at `cycle` (0 to 1) through a tree's cycle: it
+    // grows for 45%, opens its flowers over the next 10%, holds them for 30%
+    // and fades away in the last 15%
+    static void lifecycle(double cycle, double &growth, double &flowerScale)
+    {
+        if (cycle < 0.45)
+        {
+            growth = cycle / 0.45;
+            flowerScale = 0.0;
+        }
+        else if (cycle < 0.55)
+        {
+            growth = 1.0;
+            flowerScale = (cycle - 0.45) / 0.1;
+        }
+        else if (cycle < 0.85)
+        {
+            growth = 1.0;
+            flowerScale = 1.0;
+        }
+        else
+        {
+            growth = flowerScale = 1.0 - (cycle - 0.85) / 0.15;
+        }
+    }
+
+    static Detail detailFor(double trunkPixels)
+    {
+        if (trunkPixels >= FULL_TRUNK)
+            return FULL;
+        return trunkPixels >= IMPOSTOR_TRUNK ? REDUCED : IMPOSTOR;
+    }
+
+    // Call f(TreeView) for every tree of `row` whose trunk is within `margin`
+    // pixels of the screen when the camera's left edge is at cameraX, left to
+    // right. Costs a binary search plus the trees visited.
+    template <typename F>
+    void forEachVisible(int row, double seconds, double cameraX, int screenWidth, int margin, F f) const
+    {
+        const std::vector<Tree> &trees = rows[row];
+        if (trees.empty())
+            return;
+        double left = cameraX - margin;
+        double wrap = std::floor(left / worldWidth) * worldWidth; // world x of this lap's start
+        float start = static_cast<float>(left - wrap);
+        size_t i = std::lower_bound(trees.begin(), trees.end(), start, [](const Tree &tree, float x) { return tree.x < x; }) - trees.begin();
+
+        for (size_t visited = 0; visited < trees.size(); visited++, i++)
+        {
+            if (i == trees.size())
+            {
+                i = 0;
+                wrap += worldWidth;
+            }
+            const Tree &tree = trees[i];
+            double screenX = tree.x + wrap - cameraX;
+            if (screenX >= screenWidth + margin)
+                break;
+
+            double cycle = seconds / CYCLE_SECONDS * tree.cycleSpeed + tree.cycleOffset;
+            TreeView view;
+            view.tree = &tree;
+            view.screenX = static_cast<int>(std::floor(screenX));
+            lifecycle(cycle - std::floor(cycle), view.growth, view.flowerScale);
+            f(view);
+        }
+    }
+
+    // Impostor slot for a tree of `row` at (growth, flowerScale) with leaf
+    // seed `seed`; the stage is rounded to the nearest one impostors come in,
+    // which impostorStage reports back
+    static int impostorIndex(int row, double growth, double flowerScale, unsigned int seed)
+    {
+        int g = std::min(GROWTH_STEPS - 1, static_cast<int>(growth * (GROWTH_STEPS - 1) + 0.5));
+        int f = std::min(FLOWER_STEPS - 1, static_cast<int>(flowerScale * (FLOWER_STEPS - 1) + 0.5));
+        int v = static_cast<int>(seed % VARIANTS);
+        return ((row * GROWTH_STEPS + g) * FLOWER_STEPS + f) * VARIANTS + v;
+    }
+    static void impostorStage(int index, int &row, double &growth, double &flowerScale, unsigned int &variant)
+    {
+        variant = static_cast<unsigned int>(index % VARIANTS);
+        index /= VARIANTS;
+        flowerScale = static_cast<double>(index % FLOWER_STEPS) / (FLOWER_STEPS - 1);
+        index /= FLOWER_STEPS;
+        growth = static_cast<double>(index % GROWTH_STEPS) / (GROWTH_STEPS - 1);
+        row = index / GROWTH_STEPS;
+    }
+
+    // The impostor in slot `index`, rendered by build(index) on first use
+    template <typename Build>
+    const Stamp &impostor(int index, Build build)
+    {
+        if (!impostorBuilt[index])
+        {
+            impostors[index] = build(index);
+            impostorBuilt[index] = 1;
+            impostorsBuilt++;
+        }
+        return impostors[index];
+    }
+
+    // Shrink a w x h picture (alpha 0 where empty) `block` times into a stamp
+    // anchored at (anchorX, anchorY) of the original. Each target pixel takes
+    // the average colour of the drawn pixels in its block x block square when
+    // they cover at least a third of it, so twigs thinner than a block still show.
+    static Stamp shrinkToStamp(const Color *pixels, int w, int h, int anchorX, int anchorY, int block)
+    {
+        int sw = (w + block - 1) / block, sh = (h + block - 1) / block;
+        std::vector<Color> small(static_cast<size_t>(sw) * sh, 0);
+        for (int sy = 0; sy < sh; sy++)
+        {
+            for (int sx = 0; sx < sw; sx++)
+            {
+                int covered = 0, area = 0;
+                int r = 0, g = 0, b = 0;
+                for (int y = sy * block; y < std::min(h, (sy + 1) * block); y++)
+                {
+                    for (int x = sx * block; x < std::min(w, (sx + 1) * block); x++)
+                    {
+                        Color c = pixels[static_cast<size_t>(y) * w + x];
+                        area++;
+                        if (!(c >> 24))
+                            continue;
+                        covered++;
+                        r += static_cast<int>((c >> 16) & 0xFF);
+                        g += static_cast<int>((c >> 8) & 0xFF);
+                        b += static_cast<int>(c & 0xFF);
+                    }
+                }
+                if (covered * 3 >= area)
+                    small[static_cast<size_t>(sy) * sw + sx] = rgb(r / covered, g / covered, b / covered);
+            }
+        }
+        return Rasterizer::stampFromPixels(small.data(), sw, sh, anchorX / block, anchorY / block);
+    }
+};
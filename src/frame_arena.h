@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for render data that only lives until the next frame.
+// reset() at the start of a frame releases everything at once. A frame that
+// needs more than the block holds spills into extra blocks, and the next
+// reset() swaps them all for one block big enough for that frame, so after
+// the first busy frame the arena no longer touches the heap.
+class FrameArena
+{
+private:
+    std::unique_ptr<unsigned char[]> block;
+    size_t capacity = 0;
+    size_t used = 0;
+    std::vector<std::unique_ptr<unsigned char[]>> spills;
+    size_t spilledBytes = 0;
+    int growCount = 0;
+
+public:
+    explicit FrameArena(size_t bytes = 16 * 1024) : block(new unsigned char[bytes]), capacity(bytes) {}
+
+    void reset()
+    {
+        if (!spills.empty())
+        {
+            capacity = (used + spilledBytes) * 2;
+            block.reset(new unsigned char[capacity]);
+            spills.clear();
+            spilledBytes = 0;
+            growCount++;
+        }
+        used = 0;
+    }
+
+    void *allocate(size_t bytes, size_t align)
+    {
+        size_t offset = (used + align - 1) & ~(align - 1);
+        if (offset + bytes <= capacity)
+        {
+            used = offset + bytes;
+            return block.get() + offset;
+        }
+        // new[] memory is aligned for any fundamental type
+        spills.emplace_back(new unsigned char[bytes]);
+        spilledBytes += bytes;
+        return spills.back().get();
+    }
+
+    template <typename T>
+    T *allocate(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is released without running destructors");
+        return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    size_t getCapacity() const { return capacity; }
+    int getGrowCount() const { return growCount; }
+};
+
+// Growable array of trivially copyable items stored in a FrameArena. Growing
+// copies into a span twice the size and abandons the old one to the arena.
+// clear() it whenever the arena is reset.
+template <typename T>
+class FrameList
+{
+private:
+    FrameArena &arena;
+    T *items = nullptr;
+    size_t count = 0, capacity = 0;
+
+public:
+    explicit FrameList(FrameArena &a) : arena(a) {}
+
+    void clear()
+    {
+        items = nullptr;
+        count = capacity = 0;
+    }
+
+    void push_back(const T &item)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "items are moved with memcpy");
+        if (count == capacity)
+        {
+            size_t grown = capacity ? capacity * 2 : 16;
+            T *moved = arena.allocate<T>(grown);
+            if (count)
+                std::memcpy(static_cast<void *>(moved), items, count * sizeof(T));
+            items = moved;
+            capacity = grown;
+        }
+        items[count++] = item;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T &operator[](size_t i) const { return items[i]; }
+    const T *begin() const { return items; }
+    const T *end() const { return items + count; }
+};
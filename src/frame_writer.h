@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "render_backend.h"
+
+// Streams rendered frames to a Y4M (4:4:4) or concatenated binary PPM file
+// on a background thread. Frames are copied into a small ring of reusable
+// buffers; the render loop only waits when every slot is still queued, and
+// colour conversion plus I/O happen entirely on the writer thread.
+class FrameWriter
+{
+public:
+    enum Format
+    {
+        Y4M,
+        PPM
+    };
+
+private:
+    FILE *out;
+    Format format;
+    int width, height;
+    std::vector<std::vector<Color>> slots;
+    std::vector<unsigned char> encoded;
+
+    std::mutex mutex;
+    std::condition_variable frameReady;
+    std::condition_variable slotFree;
+    size_t head = 0;   // next slot the writer reads
+    size_t queued = 0; // slots holding frames not yet written
+    bool finishing = false;
+    bool failed = false;
+    long long framesWritten = 0;
+    long long producerStalls = 0;
+    std::thread worker;
+
+    void encode(const std::vector<Color> &frame)
+    {
+        size_t pixelCount = static_cast<size_t>(width) * height;
+        if (format == PPM)
+        {
+            for (size_t i = 0; i < pixelCount; i++)
+            {
+                encoded[i * 3] = static_cast<unsigned char>(colorRed(frame[i]));
+                encoded[i * 3 + 1] = static_cast<unsigned char>(colorGreen(frame[i]));
+                encoded[i * 3 + 2] = static_cast<unsigned char>(colorBlue(frame[i]));
+            }
+            return;
+        }
+
+        // BT.601 studio range, one plane after another
+        unsigned char *yPlane = encoded.data();
+        unsigned char *uPlane = yPlane + pixelCount;
+        unsigned char *vPlane = uPlane + pixelCount;
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            int r = colorRed(frame[i]), g = colorGreen(frame[i]), b = colorBlue(frame[i]);
+            yPlane[i] = static_cast<unsigned char>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            uPlane[i] = static_cast<unsigned char>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            vPlane[i] = static_cast<unsigned char>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+
+    void writerLoop()
+    {
+        while (true)
+        {
+            size_t slot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                frameReady.wait(lock, [&] { return queued > 0 || finishing; });
+                if (queued == 0)
+                    return;
+                slot = head;
+            }
+
+            encode(slots[slot]);
+            bool ok;
+            if (format == PPM)
+                ok = std::fprintf(out, "P6\n%d %d\n255\n", width, height) > 0;
+            else
+                ok = std::fputs("FRAME\n", out) >= 0;
+            ok = ok && std::fwrite(encoded.data(), 1, encoded.size(), out) == encoded.size();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                head = (head + 1) % slots.size();
+                queued--;
+                if (ok)
+                    framesWritten++;
+                else
+                    failed = true;
+            }
+            slotFree.notify_one();
+        }
+    }
+
+public:
+    FrameWriter(FILE *file, Format fileFormat, int frameWidth, int frameHeight, int frameRate, int ringSize = 4)
+        : out(file), format(fileFormat), width(frameWidth), height(frameHeight)
+    {
+        size_t pixelCount = static_cast<size_t>(width) * height;
+        slots.assign(std::max(2, ringSize), std::vector<Color>(pixelCount));
+        encoded.resize(pixelCount * 3);
+        if (format == Y4M)
+            std::fprintf(out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, frameRate);
+        worker = std::thread(&FrameWriter::writerLoop, this);
+    }
+
+    ~FrameWriter() { finish(); }
+
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    // Copy a width x height frame into the ring, waiting only if it is full
+    void submit(const Color *pixels)
+    {
+        size_t slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (queued == slots.size())
+            {
+                producerStalls++;
+                slotFree.wait(lock, [&] { return queued < slots.size(); });
+            }
+            slot = (head + queued) % slots.size();
+        }
+
+        std::memcpy(slots[slot].data(), pixels, slots[slot].size() * sizeof(Color));
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued++;
+        }
+        frameReady.notify_one();
+    }
+
+    // Drain the ring and stop the writer thread; returns false on I/O errors
+    bool finish()
+    {
+        if (worker.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finishing = true;
+            }
+            frameReady.notify_one();
+            worker.join();
+            std::fflush(out);
+        }
+        return !failed;
+    }
+
+    long long getFramesWritten() const { return framesWritten; }
+    long long getProducerStalls() const { return producerStalls; }
+};
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "dirty_region.h"
+#include "rasterizer.h"
+#include "render_backend.h"
+
+// Offscreen 32-bit RGBA framebuffer. There is no window and no page flipping:
+// every frame is drawn into the same buffer and stays there until the next
+// clear, so callers can read it back after endFrame().
+//
+// Because the buffer is retained it also supports layers: a layer caches
+// pixels across frames, and every primitive drawn straight into the frame
+// marks its bounds as dirty, so an unchanged background only has to be
+// repainted where the previous frame drew on top of it.
+class FramebufferBackend : public RenderBackend
+{
+protected:
+    int width = 0, height = 0;
+    std::vector<Color> pixels;
+    Rasterizer raster;
+
+    Color color = rgb(255, 255, 255);
+    Color fillColor = rgb(255, 255, 255);
+    Color background = rgb(0, 0, 0);
+    int lineThickness = 1;
+    int textSize = 1;
+    long long framesPresented = 0;
+
+    // A cached layer keeps its pixels plus, per row, the runs that were drawn,
+    // so compositing copies only those runs
+    struct Layer
+    {
+        std::vector<Color> pixels; // alpha 0 where nothing was drawn
+        std::vector<int> rowStart; // runs of row y are runs[rowStart[y]..rowStart[y + 1])
+        std::vector<int> runs;     // x0, x1 pairs, half-open
+        unsigned long long key = 0;
+        bool valid = false;
+    };
+    std::vector<Layer> layers;
+    int recordingLayer = -1;
+    DirtyRegion currentDirty, previousDirty;
+
+    Color *target() { return recordingLayer < 0 ? pixels.data() : layers[recordingLayer].pixels.data(); }
+
+    void touch(const ClipRect &box)
+    {
+        if (recordingLayer < 0)
+            currentDirty.mark(box);
+    }
+
+    void composite(const Layer &layer, const ClipRect &area)
+    {
+        Color *dst = target();
+        for (int y = area.top; y < area.bottom; y++)
+        {
+            size_t row = static_cast<size_t>(y) * width;
+            for (int r = layer.rowStart[y]; r < layer.rowStart[y + 1]; r += 2)
+            {
+                int x0 = std::max(layer.runs[r], area.left);
+                int x1 = std::min(layer.runs[r + 1], area.right);
+                if (x0 < x1)
+                    std::memcpy(dst + row + x0, layer.pixels.data() + row + x0, (x1 - x0) * sizeof(Color));
+            }
+        }
+    }
+
+    const DirtyRegion *region(LayerArea area) const
+    {
+        if (area == LayerArea::PREVIOUS_DIRTY)
+            return &previousDirty;
+        if (area == LayerArea::CURRENT_DIRTY)
+            return &currentDirty;
+        return nullptr;
+    }
+
+public:
+    void initialize(int w, int h, const char *title) override
+    {
+        (void)title;
+        width = w;
+        height = h;
+        pixels.assign(static_cast<size_t>(w) * h, background);
+        raster.setTarget(pixels.data(), w, h);
+        layers.clear();
+        currentDirty.resize(w, h);
+        previousDirty.resize(w, h);
+    }
+
+    void shutdown() override {}
+
+    void beginFrame() override
+    {
+        previousDirty.swap(currentDirty);
+        currentDirty.clear();
+    }
+    void endFrame() override { framesPresented++; }
+
+    void setColor(Color c) override { color = c; }
+    Color getColor() const override { return color; }
+    void setFillColor(Color c) override { fillColor = c; }
+    void setLineThickness(int thickness) override { lineThickness = thickness; }
+    void setBackground(Color c) override { background = c; }
+    void setTextSize(int size) override { textSize = size; }
+
+    void clear() override
+    {
+        raster.bar(0, 0, width - 1, height - 1, background);
+        if (recordingLayer < 0)
+            currentDirty.markAll();
+    }
+    void line(int x1, int y1, int x2, int y2) override
+    {
+        raster.line(x1, y1, x2, y2, lineThickness, color);
+        touch(Rasterizer::lineBounds(x1, y1, x2, y2, lineThickness));
+    }
+    void lines(const LineSegment *segments, int count, bool antialias) override
+    {
+        if (count <= 0)
+            return;
+        raster.lines(segments, count, antialias);
+        color = segments[count - 1].color;
+        lineThickness = segments[count - 1].thickness;
+        for (int i = 0; i < count && recordingLayer < 0; i++)
+        {
+            const LineSegment &s = segments[i];
+            currentDirty.mark(antialias ? Rasterizer::smoothLineBounds(s.x1, s.y1, s.x2, s.y2, s.thickness)
+                                        : Rasterizer::lineBounds(s.x1, s.y1, s.x2, s.y2, s.thickness));
+        }
+    }
+    void fillEllipse(int x, int y, int rx, int ry) override
+    {
+        raster.fillEllipse(x, y, rx, ry, fillColor);
+        touch(Rasterizer::ellipseBounds(x, y, rx, ry));
+    }
+    void fillPoly(int numPoints, const int *points) override
+    {
+        raster.fillPoly(numPoints, points, fillColor, color);
+        if (numPoints >= 2)
+            touch(Rasterizer::polyBounds(numPoints, points));
+    }
+    void bar(int left, int top, int right, int bottom) override
+    {
+        raster.bar(left, top, right, bottom, fillColor);
+        touch(Rasterizer::barBounds(left, top, right, bottom));
+    }
+    void text(int x, int y, const char *str) override
+    {
+        raster.text(x, y, str, textSize, color);
+        touch(Rasterizer::textBounds(x, y, static_cast<int>(std::strlen(str)), textSize));
+    }
+
+    bool fastStamps() const override { return true; }
+    void stamps(const Stamp &stamp, int count, const int *positions) override
+    {
+        raster.stamps(stamp, count, positions);
+        if (recordingLayer >= 0 || stamp.spans.empty())
+            return;
+        for (int i = 0; i < count; i++)
+        {
+            int x = positions[i * 2], y = positions[i * 2 + 1];
+            currentDirty.mark({x + stamp.left, y + stamp.top, x + stamp.right + 1, y + stamp.bottom + 1});
+        }
+    }
+
+    bool supportsLayers() const override { return true; }
+
+    bool layerCurrent(int id, unsigned long long key) const override
+    {
+        return id < static_cast<int>(layers.size()) && layers[id].valid && layers[id].key == key;
+    }
+
+    void beginLayer(int id, unsigned long long key) override
+    {
+        if (id >= static_cast<int>(layers.size()))
+            layers.resize(id + 1);
+        Layer &layer = layers[id];
+        layer.pixels.assign(static_cast<size_t>(width) * height, 0);
+        layer.key = key;
+        recordingLayer = id;
+        raster.setTarget(layer.pixels.data(), width, height);
+    }
+
+    void endLayer() override
+    {
+        Layer &layer = layers[recordingLayer];
+        layer.rowStart.assign(1, 0);
+        layer.runs.clear();
+        for (int y = 0; y < height; y++)
+        {
+            const Color *row = layer.pixels.data() + static_cast<size_t>(y) * width;
+            for (int x = 0; x < width;)
+            {
+                if (!(row[x] >> 24))
+                {
+                    x++;
+                    continue;
+                }
+                layer.runs.push_back(x);
+                while (x < width && (row[x] >> 24))
+                    x++;
+                layer.runs.push_back(x);
+            }
+            layer.rowStart.push_back(static_cast<int>(layer.runs.size()));
+        }
+        layer.valid = true;
+        recordingLayer = -1;
+        raster.setTarget(pixels.data(), width, height);
+    }
+
+    void drawLayer(int id, LayerArea area) override
+    {
+        if (id >= static_cast<int>(layers.size()) || !layers[id].valid)
+            return;
+        const Layer &layer = layers[id];
+        if (const DirtyRegion *dirty = region(area))
+            dirty->forEachRun([&](const ClipRect &rect) { composite(layer, rect); });
+        else
+            composite(layer, {0, 0, width, height});
+    }
+
+    void clearArea(LayerArea area) override
+    {
+        if (const DirtyRegion *dirty = region(area))
+            dirty->forEachRun([&](const ClipRect &rect) { raster.bar(rect.left, rect.top, rect.right - 1, rect.bottom - 1, background); });
+        else
+            raster.bar(0, 0, width - 1, height - 1, background);
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    const Color *data() const { return pixels.data(); }
+    long long getFramesPresented() const { return framesPresented; }
+
+    // 64-bit FNV-1a over the RGB of every pixel (one word per step), for
+    // comparing frames
+    unsigned long long hash() const
+    {
+        unsigned long long h = 14695981039346656037ull;
+        for (Color c : pixels)
+        {
+            h = (h ^ (c & 0xFFFFFF)) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    // Binary PPM of the current buffer, handy for eyeballing offscreen output
+    bool writePPM(const char *path) const
+    {
+        FILE *file = std::fopen(path, "wb");
+        if (!file)
+            return false;
+        std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+        std::vector<unsigned char> row(static_cast<size_t>(width) * 3);
+        for (int y = 0; y < height; y++)
+        {
+            const Color *src = pixels.data() + static_cast<size_t>(y) * width;
+            for (int x = 0; x < width; x++)
+            {
+                row[x * 3] = static_cast<unsigned char>(colorRed(src[x]));
+                row[x * 3 + 1] = static_cast<unsigned char>(colorGreen(src[x]));
+                row[x * 3 + 2] = static_cast<unsigned char>(colorBlue(src[x]));
+            }
+            std::fwrite(row.data(), 1, row.size(), file);
+        }
+        return std::fclose(file) == 0;
+    }
+};
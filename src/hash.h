@@ -0,0 +1,19 @@
+#pragma once
+
+// Integer hash (the MurmurHash3 finalizer) for deterministic pseudo-random
+// values: the same inputs always give the same bits
+inline unsigned int mixBits(unsigned int h)
+{
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+// Uniform value in [0, 1) for (seed, key)
+inline float unitHash(unsigned int seed, unsigned int key)
+{
+    return (mixBits(seed * 0x9E3779B9u ^ key) >> 8) * (1.0f / 16777216.0f);
+}
@@ -1,254 +1,510 @@
-#include <graphics.h>
-
+#include <atomic>
+#include <cerrno>
 #include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iterator>
 #include <iostream>
+#include <memory>
 #include <thread>
 #include <vector>
 
-struct Point
-{
-    int x, y;
-};
-
-struct Seed
-{
-    double x, y;
-    double angle;
-    double velocityY;
-    bool active;
-};
+#include "benchmarks.h"
+#include "branch_geometry.h"
+#include "branch_sway.h"
+#include "forest.h"
+#include "frame_writer.h"
+#include "frame_arena.h"
+#include "framebuffer_backend.h"
+#include "profiler.h"
+#include "quality_governor.h"
+#include "recording_backend.h"
+#include "render_backend.h"
+#include "scene.h"
+#include "seed_particles.h"
+#include "shared_frame_ring.h"
+#include "sprite_atlas.h"
+#include "tiled_backend.h"
+#include "tree_grammar.h"
+#include "tree_state.h"
+#include "triple_buffer.h"
+#include "trig_tables.h"
+#include "view_transform.h"
+#ifndef HEADLESS
+#include "bgi_backend.h"
+#endif
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 class AnimatedTreeDrawer
 {
 private:
+    RenderBackend &gfx;
     int screenWidth, screenHeight;
     int groundLevel;
-    int seedX, seedY;
-    std::chrono::steady_clock::time_point lastTime;
-    double sunAngle; // for moving sun
-
-    // Animation state variables
-    double treeGrowthScale;
-    double flowerScale;
-    bool showFlowers;
+
+    // Animation state: the simulation advances `sim` in fixed ticks of
+    // SIMULATION_DT; render() draws `view`, blended between `previousSim` and
+    // `sim` when a frame falls between two ticks.
+    static constexpr int SIMULATION_HZ = 30;
+    static constexpr double SIMULATION_DT = 1.0 / SIMULATION_HZ;
+    TreeState sim;
+    TreeState previousSim;
+    TreeState view;
+    int cyclesCompleted;
+    int renderRate;
+    bool fixedClock; // advance one frame interval per frame instead of by the wall clock
+    unsigned int leafSeed; // seeds the per-branch leaf jitter
+    const TreeGrammar *grammar; // species of the single tree
+    TreeGrammar customGrammar;  // where a grammar from the command line lives
+    int grammarDepth;           // levels of it to grow
+    BranchGeometry tipGeometry; // full-grown tree, to find where the seed drops from
+
     int flowerPosX, flowerPosY;
-    std::vector<Point> flowerPositions;
-    std::vector<Seed> fallingSeeds;
-    int animationPhase; // 0: seed germination, 1: tree growth, 2: flowering, 3: seed fall, 4: reset
-    int phaseTimer;
-    int rightmostBranchX, rightmostBranchY;
-    double zoomScale;
-    int cameraOffsetX, cameraOffsetY;
+
+    // Scratch memory for the frame being drawn, reset at the start of render()
+    FrameArena frameArena;
+
+    // Seeds released by every flower at the end of flowering, in world
+    // coordinates; they live outside TreeState so ticks don't copy them
+    SeedParticles seedParticles;
+    SeedParticles *drawnParticles; // what render() draws: seedParticles, or a snapshot's copy
+    int seedsPerFlower;
+    double viewAlpha; // how far `view` is past the last tick, for the particles
+
+    // Everything render() takes from the simulation for one frame, handed
+    // from the simulation thread to the render thread in pipelined mode
+    struct FrameSnapshot
+    {
+        TreeState state;
+        double alpha = 0.0;
+        SeedParticles particles;
+    };
+
+    // Flattened tree, rebuilt only when its growth parameters change
+    BranchGeometry branchGeometry;
+    bool useBranchCache;
+    std::vector<int> screenPoints; // segment end points of the tree being drawn, in pixels
+    std::vector<LineSegment> branchSegments; // the list drawBranchGeometry is collecting
+    bool smoothBranches;                     // anti-alias the branches
+
+    // Incremental growth: segments grow to full length and stay, and the
+    // finished ones are kept in a layer while the tree grows in place
+    static const int LAYER_TREE = 1;
+    bool incrementalGrowth;
+    bool treeLayerShown; // the last frame composited the tree layer
+    int treeLayerBuilds;
+
+    // Trees bend in `wind` when its strength is above 0; each tree has its
+    // own BranchSway holding its rest pose, attached again only when the
+    // tree's geometry changes
+    WindField wind;
+    BranchSway treeSway;
+    long long swayNanos;    // spent in BranchSway::attach and apply
+    long long swayAttaches; // rest poses attached
+    long long swaySegments; // segments swayed
+
+    // Lowers the detail below when frames run over budget
+    QualityGovernor governor;
+
+    // Suns and clouds as entities with dense components, placed and drawn by
+    // the scene's systems
+    Scene scene;
+
+    // Cached cloud layer, on backends that keep pixels between frames
+    static const int LAYER_CLOUDS = 0;
+    bool useLayers;
+    bool backgroundDrawn; // the frame holds a full background in backgroundSky
+    Color backgroundSky;
+    long long culledSegments; // segments skipped by viewport culling
+
+    // Forest mode: many trees on land scrolling past at FOREST_SCROLL pixels
+    // per second, drawn instead of the single tree when `forest` is set
+    static constexpr double FOREST_SCROLL = 40.0;
+    std::unique_ptr<Forest> forest;
+    BranchGeometry forestGeometry; // the tree being drawn, rebuilt for each one
+    long long forestDrawn[3];      // trees drawn at each Forest::Detail
+    int forestVisible;             // trees in the last frame
+
+    // A forest tree's rest pose and the build it was taken from, by tree
+    // index. A tree missing from the last frame may have come back on
+    // another lap, so it attaches again, into the same buffers.
+    struct ForestSway
+    {
+        BranchSway sway;
+        int depth = 0, leaves = 0;
+        double growth = -1.0;
+        long long frame = -1; // last frame it was drawn in
+    };
+    std::vector<ForestSway> forestSways;
+    long long forestFrames; // frames drawForest has drawn
 
     // Colors
-    const int BROWN = COLOR(139, 69, 19);
-    const int DARK_BROWN = COLOR(101, 67, 33);
-    const int LEAF_GREEN = COLOR(34, 139, 34);
-    const int LIGHT_GREEN = COLOR(50, 205, 50);
-    const int SKY_BLUE = COLOR(135, 206, 235);
-    const int SOIL_BROWN = COLOR(90, 50, 20);
+    const Color BROWN = rgb(139, 69, 19);
+    const Color DARK_BROWN = rgb(101, 67, 33);
+    const Color LEAF_GREEN = rgb(34, 139, 34);
+    const Color LIGHT_GREEN = rgb(50, 205, 50);
+    const Color SKY_BLUE = rgb(135, 206, 235);
+    const Color SOIL_BROWN = rgb(90, 50, 20);
+    const Color YELLOW = rgb(255, 255, 85);
+    const Color WHITE = rgb(255, 255, 255);
+
+    // Pre-rasterized flowers, leaves and seeds; off draws their exact geometry
+    SpriteAtlas sprites;
+    bool useSprites;
+
+    // `count` leaves of radius `size` centred at the (x, y) pairs in positions
+    void drawLeaves(RenderBackend &target, const int *positions, int count, int size)
+    {
+        const Stamp *stamp = useSprites ? sprites.leaf(size) : nullptr;
+        if (stamp)
+        {
+            target.stamps(*stamp, count, positions);
+            target.setFillColor(LIGHT_GREEN); // where the ellipses would have left it
+            return;
+        }
+        for (int i = 0; i < count; i++)
+            target.fillEllipse(positions[i * 2], positions[i * 2 + 1], size, size);
+    }
 
     // Draw a seed with rotation
     void drawSeed(int x, int y, double angle, double scale = 1.0)
     {
-        int oldColor = getcolor();
+        Color oldColor = gfx.getColor();
 
-        setcolor(COLOR(160, 82, 45));
-        setfillstyle(SOLID_FILL, COLOR(160, 82, 45));
+        gfx.setColor(rgb(160, 82, 45));
+        gfx.setFillColor(rgb(160, 82, 45));
 
         int size = static_cast<int>(8 * scale);
 
-        // Draw seed as rotated oval using rotation transformation
-        // Calculate 4 points of the oval and rotate them
-        const int numPoints = 12;
-        int points[numPoints * 2];
-
-        for (int i = 0; i < numPoints; i++)
+        const Stamp *stamp = useSprites ? sprites.seed(size, angle) : nullptr;
+        if (stamp)
         {
-            double t = i * 2 * 3.14159 / numPoints;
-            // Oval shape (wider than tall)
-            double localX = size * cos(t);
-            double localY = size * 0.5 * sin(t);
-
-            // Apply rotation transformation
-            int rotatedX = static_cast<int>(localX * cos(angle) - localY * sin(angle));
-            int rotatedY = static_cast<int>(localX * sin(angle) + localY * cos(angle));
-
-            points[i * 2] = x + rotatedX;
-            points[i * 2 + 1] = y + rotatedY;
+            int position[2] = {x, y};
+            gfx.stamps(*stamp, 1, position);
+            gfx.setFillColor(rgb(160, 82, 45));
+            gfx.setLineThickness(std::max(1, static_cast<int>(scale / 3)));
+            gfx.setColor(oldColor);
+            return;
         }
 
-        // Fill the rotated seed
-        fillpoly(numPoints, points);
-
-        // Draw a line through the seed to show rotation clearly
-        int lineLength = static_cast<int>(size * 0.8);
-        int lineX1 = x + static_cast<int>(lineLength * cos(angle));
-        int lineY1 = y + static_cast<int>(lineLength * sin(angle));
-        int lineX2 = x - static_cast<int>(lineLength * cos(angle));
-        int lineY2 = y - static_cast<int>(lineLength * sin(angle));
+        // Draw seed as rotated oval using rotation transformation, with a
+        // line through it to show the rotation clearly
+        int points[24], line[4];
+        seedShape(x, y, angle, size, points, line);
+        gfx.fillPoly(12, points);
 
-        setcolor(COLOR(100, 50, 20));
-        setlinestyle(SOLID_LINE, 0, std::max(1, static_cast<int>(scale / 3)));
-        line(lineX1, lineY1, lineX2, lineY2);
+        gfx.setColor(rgb(100, 50, 20));
+        gfx.setLineThickness(std::max(1, static_cast<int>(scale / 3)));
+        gfx.line(line[0], line[1], line[2], line[3]);
 
-        setcolor(oldColor);
+        gfx.setColor(oldColor);
     }
 
-    // Draw soil layers
-    void drawSoil()
+    // Draw soil layers with the surface at surfaceY
+    void drawSoil(int surfaceY)
     {
+        PROFILE_SCOPE(DRAW_SOIL);
+
         // Ground surface
-        setcolor(DARK_BROWN);
-        setfillstyle(SOLID_FILL, DARK_BROWN);
-        bar(0, groundLevel, screenWidth, groundLevel + 50);
+        gfx.setColor(DARK_BROWN);
+        gfx.setFillColor(DARK_BROWN);
+        gfx.bar(0, surfaceY, screenWidth, surfaceY + 50);
 
         // Underground soil (darker)
-        setcolor(SOIL_BROWN);
-        setfillstyle(SOLID_FILL, SOIL_BROWN);
-        bar(0, groundLevel + 50, screenWidth, screenHeight);
+        gfx.setColor(SOIL_BROWN);
+        gfx.setFillColor(SOIL_BROWN);
+        gfx.bar(0, surfaceY + 50, screenWidth, screenHeight);
     }
 
-    // Draw a branch recursively with scaling
-    void drawBranch(int x1, int y1, double length, double angle, int depth, double scale, double growthProgress = 1.0)
+    // Sky, sun, clouds and soil. Unless they drift the clouds never move, so
+    // they are cached in a layer, and while the sky colour stays the same
+    // only the parts the previous frame drew over are repainted. The sun sits
+    // between the sky and the clouds, so the layer is reapplied over it; the
+    // soil follows the camera and is cheap, so it is always drawn.
+    void drawBackground(Color sky, int surfaceY)
+    {
+        if (!useLayers || !gfx.supportsLayers() || scene.hasDrift())
+        {
+            gfx.setBackground(sky);
+            gfx.clear();
+
+            drawSun();
+            drawClouds();
+            drawSoil(surfaceY);
+            return;
+        }
+
+        int circles = governor.quality().cloudCircles;
+        if (!gfx.layerCurrent(LAYER_CLOUDS, circles))
+        {
+            gfx.beginLayer(LAYER_CLOUDS, circles);
+            drawClouds();
+            gfx.endLayer();
+            backgroundDrawn = false;
+        }
+
+        gfx.setBackground(sky);
+        if (backgroundDrawn && sky == backgroundSky)
+        {
+            gfx.clearArea(LayerArea::PREVIOUS_DIRTY);
+            gfx.drawLayer(LAYER_CLOUDS, LayerArea::PREVIOUS_DIRTY);
+            drawSun();
+            gfx.drawLayer(LAYER_CLOUDS, LayerArea::CURRENT_DIRTY);
+        }
+        else
+        {
+            gfx.clearArea(LayerArea::FULL);
+            drawSun();
+            gfx.drawLayer(LAYER_CLOUDS, LayerArea::FULL);
+        }
+        backgroundDrawn = true;
+        backgroundSky = sky;
+
+        drawSoil(surfaceY);
+    }
+
+    // Simulation time of the frame being drawn, in seconds
+    double viewSeconds() const { return (view.tick - (viewAlpha > 0 ? 1.0 - viewAlpha : 0.0)) * SIMULATION_DT; }
+
+    // Bend a freshly built or already swayed `tree` standing at world x
+    // baseX for this frame's wind, taking it as the rest pose first if
+    // `restChanged`
+    void swayTree(BranchGeometry &tree, BranchSway &sway, double baseX, bool restChanged)
+    {
+        if (wind.strength <= 0)
+            return;
+        PROFILE_SCOPE(SWAY);
+        auto start = std::chrono::steady_clock::now();
+        if (restChanged)
+        {
+            sway.attach(tree, static_cast<float>(baseX));
+            swayAttaches++;
+        }
+        sway.apply(tree, wind);
+        swaySegments += static_cast<long long>(tree.size());
+        swayNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Levels of the tree to draw: the species' depth less what the governor takes off
+    int drawnDepth() const { return std::max(1, grammarDepth - governor.quality().depthCut); }
+
+    // Draw a branch of the grammar's tree recursively with scaling, from world
+    // point (x1, y1) through toScreen, `depth` levels of a tree `maxDepth` deep; `branch`
+    // numbers it as in BranchGeometry::childBranch so leaves land where the
+    // cached tree has them
+    void drawBranch(const ViewTransform &toScreen, float x1, float y1, double length, Direction direction, int depth, int maxDepth, double scale,
+                    double growthProgress = 1.0, unsigned int branch = 0)
     {
         if (depth <= 0 || scale <= 0.1)
             return;
 
-        double branchProgress = std::min(1.0, std::max(0.0, (growthProgress * 10) - (8 - depth)));
+        double branchProgress = std::min(1.0, std::max(0.0, (growthProgress * std::max(10, maxDepth + 2)) - (maxDepth - depth)));
         if (branchProgress <= 0)
             return;
 
         double scaledLength = length * scale * branchProgress;
 
-        int x2 = x1 + static_cast<int>(scaledLength * cos(angle));
-        int y2 = y1 - static_cast<int>(scaledLength * sin(angle));
-
-        // Track rightmost position for flower/seed
-        if (depth == 1 && x2 > rightmostBranchX)
-        {
-            rightmostBranchX = x2;
-            rightmostBranchY = y2;
-        }
+        float x2 = x1 + static_cast<float>(scaledLength * direction.c);
+        float y2 = y1 - static_cast<float>(scaledLength * direction.s);
+        int screenX1, screenY1, screenX2, screenY2;
+        toScreen.map(x1, y1, screenX1, screenY1);
+        toScreen.map(x2, y2, screenX2, screenY2);
 
-        if (depth > 4)
+        if (depth > grammar->twigLevels)
         {
-            setcolor(BROWN);
-            setlinestyle(SOLID_LINE, 0, static_cast<int>(depth * scale) + 1);
+            gfx.setColor(BROWN);
+            gfx.setLineThickness(static_cast<int>(depth * scale) + 1);
         }
         else
         {
-            setcolor(LEAF_GREEN);
-            setlinestyle(SOLID_LINE, 0, std::max(1, static_cast<int>(depth * scale)));
+            gfx.setColor(LEAF_GREEN);
+            gfx.setLineThickness(std::max(1, static_cast<int>(depth * scale)));
         }
 
-        line(x1, y1, x2, y2);
+        gfx.line(screenX1, screenY1, screenX2, screenY2);
 
-        if (depth <= 5 && scale > 0.5 && branchProgress > 0.8)
+        if (depth <= grammar->leafLevels && scale > 0.5 && branchProgress > 0.8)
         {
-            setcolor(LIGHT_GREEN);
-            setfillstyle(SOLID_FILL, LIGHT_GREEN);
+            gfx.setColor(LIGHT_GREEN);
+            gfx.setFillColor(LIGHT_GREEN);
 
-            int numLeaves = (depth <= 3) ? 3 : 2;
+            int numLeaves = std::min((depth <= 3) ? 3 : 2, governor.quality().leavesPerTip);
+            int leaves[6];
             for (int i = 0; i < numLeaves; i++)
             {
-                int leafX = x2 + (rand() % 10 - 5);
-                int leafY = y2 + (rand() % 10 - 5);
-                int leafSize = static_cast<int>(4 * scale);
-                fillellipse(leafX, leafY, leafSize, leafSize);
+                leaves[i * 2] = screenX2 + BranchGeometry::leafJitter(leafSeed, branch, i, 0);
+                leaves[i * 2 + 1] = screenY2 + BranchGeometry::leafJitter(leafSeed, branch, i, 1);
             }
+            drawLeaves(gfx, leaves, numLeaves, static_cast<int>(4 * scale));
         }
 
         // Draw flowers only at depth 1
-        if (depth == 1 && showFlowers && scale > 0.8 && branchProgress > 0.9)
+        if (depth == 1 && view.showFlowers && scale > 0.8 && branchProgress > 0.9)
         {
-            drawFlower(x2, y2, flowerScale);
+            drawFlower(gfx, screenX2, screenY2, view.flowerScale);
         }
 
-        double newLength = length * 0.7;
-        drawBranch(x2, y2, newLength, angle - 0.3, depth - 1, scale, growthProgress);
-        drawBranch(x2, y2, newLength, angle + 0.3, depth - 1, scale, growthProgress);
-        drawBranch(x2, y2, newLength * 0.8, angle, depth - 1, scale, growthProgress);
+        for (int k = 0; k < grammar->childCount; k++)
+        {
+            const TreeGrammar::Child &child = grammar->children[k];
+            drawBranch(toScreen, x2, y2, length * child.lengthFactor, direction.turned(child.turn), depth - 1, maxDepth, scale, growthProgress,
+                       BranchGeometry::childBranch(branch, k, grammar->childCount));
+        }
     }
 
-    void drawFlower(int x, int y, double scale)
+    // Which segments drawBranchGeometry draws: all of them, or (without
+    // flowers) only those that have finished growing or only the rest
+    enum class Segments
+    {
+        ALL,
+        GROWN,
+        GROWING
+    };
+
+    // Draw the cached tree through toScreen, which maps its trunk base to
+    // where the tree stands. All end points are mapped to pixels in one batch
+    // first, and the segments go to the backend in lists passed to lines(),
+    // cut only where leaves or a flower must go on top. Draws what drawBranch
+    // would, minus subtrees that lie entirely outside `area` (the screen
+    // unless given, in target pixels).
+    void drawBranchGeometry(RenderBackend &target, const BranchGeometry &tree, const ViewTransform &toScreen, bool showFlowers, double flowerScale,
+                            Segments which = Segments::ALL, const ClipRect *area = nullptr)
     {
+        ClipRect cull = area ? *area : ClipRect{0, 0, screenWidth, screenHeight};
+        branchSegments.clear();
+        auto flush = [&]() {
+            target.lines(branchSegments.data(), static_cast<int>(branchSegments.size()), smoothBranches);
+            branchSegments.clear();
+        };
+        int lastThickness = -1;
+        int flowerReach = showFlowers ? static_cast<int>(8 * flowerScale) + 1 : 0;
+        int count = static_cast<int>(tree.size());
+
+        screenPoints.resize(tree.size() * 4);
+        int *screenX1 = screenPoints.data(), *screenY1 = screenX1 + count;
+        int *screenX2 = screenY1 + count, *screenY2 = screenX2 + count;
+        toScreen.map(tree.x1.data(), tree.y1.data(), tree.size(), screenX1, screenY1);
+        toScreen.map(tree.x2.data(), tree.y2.data(), tree.size(), screenX2, screenY2);
+
+        float pad = tree.swayReach;
+        for (int i = 0; i < count; i++)
+        {
+            int left, top, right, bottom;
+            toScreen.bounds(tree.boxLeft[i] - pad, tree.boxTop[i] - pad, tree.boxRight[i] + pad, tree.boxBottom[i] + pad, left, top, right, bottom);
+            if (right + flowerReach < cull.left || left - flowerReach >= cull.right || bottom + flowerReach < cull.top || top - flowerReach >= cull.bottom)
+            {
+                culledSegments += tree.subtreeEnd[i] - i;
+                i = tree.subtreeEnd[i] - 1;
+                continue;
+            }
+            if (which != Segments::ALL && (tree.grown[i] != 0) != (which == Segments::GROWN))
+                continue;
+
+            Color color = tree.colorClass[i] == BranchGeometry::WOOD ? BROWN : LEAF_GREEN;
+            branchSegments.push_back({screenX1[i], screenY1[i], screenX2[i], screenY2[i], tree.thickness[i], color});
+            lastThickness = tree.thickness[i];
+
+            int leafBegin = tree.leafStart[i];
+            int leafEnd = tree.leafStart[i + 1];
+            if (leafBegin < leafEnd)
+            {
+                flush();
+                target.setColor(LIGHT_GREEN);
+                target.setFillColor(LIGHT_GREEN);
+                // A segment's leaves all have the same size
+                int leaves[6];
+                int n = std::min(leafEnd - leafBegin, 3);
+                for (int leaf = 0; leaf < n; leaf++)
+                {
+                    leaves[leaf * 2] = screenX2[i] + tree.leafOffsetX[leafBegin + leaf];
+                    leaves[leaf * 2 + 1] = screenY2[i] + tree.leafOffsetY[leafBegin + leaf];
+                }
+                drawLeaves(target, leaves, n, tree.leafSize[leafBegin]);
+            }
+
+            if (showFlowers && which == Segments::ALL && tree.flowerTip[i])
+            {
+                flush();
+                drawFlower(target, screenX2[i], screenY2[i], flowerScale);
+            }
+        }
+        flush();
+
+        // Later lines (the sun rays) inherit the width, so leave it where the full walk would
+        if (count > 0 && lastThickness != tree.thickness[count - 1])
+            target.setLineThickness(tree.thickness[count - 1]);
+    }
+
+    void drawFlower(RenderBackend &target, int x, int y, double scale)
+    {
+        PROFILE_SCOPE(DRAW_FLOWER);
+
         if (scale <= 0)
             return;
 
-        // Collect all flower positions
-        Point flowerPos;
-        flowerPos.x = x;
-        flowerPos.y = y;
-        flowerPositions.push_back(flowerPos);
-
         int petalSize = static_cast<int>(4 * scale);
 
-        setcolor(COLOR(255, 192, 203));
-        setfillstyle(SOLID_FILL, COLOR(255, 192, 203));
+        // Low quality: one disc about as wide as the petals, and the centre
+        if (!governor.quality().flowerPetals)
+        {
+            target.setColor(rgb(255, 192, 203));
+            target.setFillColor(rgb(255, 192, 203));
+            target.fillEllipse(x, y, petalSize * 3 / 2, petalSize * 3 / 2);
+            target.setColor(YELLOW);
+            target.setFillColor(YELLOW);
+            target.fillEllipse(x, y, petalSize - 1, petalSize - 1);
+            return;
+        }
+
+        const Stamp *stamp = useSprites ? sprites.flower(petalSize) : nullptr;
+        if (stamp)
+        {
+            int position[2] = {x, y};
+            target.stamps(*stamp, 1, position);
+            target.setColor(YELLOW);
+            target.setFillColor(YELLOW);
+            return;
+        }
+
+        target.setColor(rgb(255, 192, 203));
+        target.setFillColor(rgb(255, 192, 203));
 
         for (int i = 0; i < 5; i++)
         {
-            double angle = i * 2 * 3.14159 / 5;
-            int petalX = x + static_cast<int>(petalSize * cos(angle));
-            int petalY = y + static_cast<int>(petalSize * sin(angle));
-            fillellipse(petalX, petalY, petalSize, petalSize);
+            int petalX = x + static_cast<int>(petalSize * FLOWER_PETALS.cosines[i]);
+            int petalY = y + static_cast<int>(petalSize * FLOWER_PETALS.sines[i]);
+            target.fillEllipse(petalX, petalY, petalSize, petalSize);
         }
 
-        setcolor(YELLOW);
-        setfillstyle(SOLID_FILL, YELLOW);
-        fillellipse(x, y, petalSize - 1, petalSize - 1);
+        target.setColor(YELLOW);
+        target.setFillColor(YELLOW);
+        target.fillEllipse(x, y, petalSize - 1, petalSize - 1);
     }
 
-    // Draw the sun
+    // Draw the suns
     void drawSun()
     {
-        int radius = 30;
-        int skyHeight = 150;
-        int sunX = static_cast<int>(screenWidth * sunAngle / 3.14159);
-        int sunY = static_cast<int>(skyHeight * sin(sunAngle)) + 50;
-
-        setcolor(YELLOW);
-        setfillstyle(SOLID_FILL, YELLOW);
-        fillellipse(sunX, sunY, radius, radius);
-
-        for (int i = 0; i < 12; i++)
-        {
-            double angle = i * 30 * 3.14159 / 180.0;
-            int x1 = sunX + static_cast<int>((radius + 5) * cos(angle));
-            int y1 = sunY + static_cast<int>((radius + 5) * sin(angle));
-            int x2 = sunX + static_cast<int>((radius + 20) * cos(angle));
-            int y2 = sunY + static_cast<int>((radius + 20) * sin(angle));
-            line(x1, y1, x2, y2);
-        }
+        PROFILE_SCOPE(DRAW_SUN);
+        scene.drawSuns(gfx);
     }
 
     // Draw clouds
     void drawClouds()
     {
-        setcolor(WHITE);
-        setfillstyle(SOLID_FILL, WHITE);
-
-        for (int cloud = 0; cloud < 3; cloud++)
-        {
-            int cloudX = 100 + cloud * 200;
-            int cloudY = 80 + (cloud * 17) % 50;
-
-            for (int i = 0; i < 5; i++)
-            {
-                int circleX = cloudX + i * 25;
-                int circleY = cloudY + ((i * 13) % 20 - 10);
-                int radius = 20 + (i * 7) % 10;
-                fillellipse(circleX, circleY, radius, radius);
-            }
-        }
+        PROFILE_SCOPE(DRAW_CLOUDS);
+        scene.drawClouds(gfx, governor.quality().cloudCircles);
     }
 
     // Update falling seeds with physics
     void updateFallingSeeds()
     {
-        for (auto &seed : fallingSeeds)
+        for (auto &seed : sim.fallingSeeds)
         {
             if (!seed.active)
                 continue;
@@ -267,8 +523,8 @@ private:
             if (seed.y >= groundLevel + 80)
             {
                 seed.active = false;
-                seedX = static_cast<int>(seed.x);
-                seedY = groundLevel + 25;
+                sim.seedX = static_cast<int>(seed.x);
+                sim.seedY = groundLevel + 25;
             }
         }
     }
@@ -276,11 +532,13 @@ private:
     // Display phase information
     void displayPhaseInfo()
     {
-        setcolor(WHITE);
-        settextstyle(DEFAULT_FONT, HORIZ_DIR, 2);
+        PROFILE_SCOPE(DISPLAY_PHASE_INFO);
+
+        gfx.setColor(WHITE);
+        gfx.setTextSize(2);
 
         char title[100];
-        switch (animationPhase)
+        switch (view.animationPhase)
         {
         case 0:
             sprintf(title, "Phase 1: Seed Germination");
@@ -301,11 +559,11 @@ private:
             sprintf(title, "Phase 6: Cycle Reset");
             break;
         }
-        outtextxy(10, 10, title);
+        gfx.text(10, 10, title);
 
-        settextstyle(DEFAULT_FONT, HORIZ_DIR, 1);
+        gfx.setTextSize(1);
         char msg[] = "Press ESC to exit, SPACE to restart";
-        outtextxy(10, screenHeight - 20, msg);
+        gfx.text(10, screenHeight - 20, msg);
     }
 
     void drawSeedlingLeaves(int x, int y, double progress)
@@ -314,9 +572,9 @@ private:
         int stemHeight = static_cast<int>(60 * progress); // Increased from 30
 
         // Draw stem (this becomes the trunk)
-        setcolor(LEAF_GREEN);
-        setlinestyle(SOLID_LINE, 0, std::max(2, static_cast<int>(progress * 4)));
-        line(x, y, x, y - stemHeight);
+        gfx.setColor(LEAF_GREEN);
+        gfx.setLineThickness(std::max(2, static_cast<int>(progress * 4)));
+        gfx.line(x, y, x, y - stemHeight);
 
         // Leaves appear and grow
         if (progress > 0.2)
@@ -325,132 +583,405 @@ private:
             int leafSize = static_cast<int>(20 * leafProgress);   // Increased from 15
             int leafYOffset = static_cast<int>(stemHeight * 0.5); // Position leaves partway up stem
 
-            setcolor(LIGHT_GREEN);
-            setfillstyle(SOLID_FILL, LIGHT_GREEN);
+            gfx.setColor(LIGHT_GREEN);
+            gfx.setFillColor(LIGHT_GREEN);
+
+            // Left and right leaf - angled outward
+            const Stamp *stamp = useSprites ? sprites.seedlingLeaf(leafSize) : nullptr;
+            if (stamp)
+            {
+                int positions[4] = {x - leafSize, y - leafYOffset, x + leafSize, y - leafYOffset};
+                gfx.stamps(*stamp, 2, positions);
+                gfx.setFillColor(LIGHT_GREEN);
+                return;
+            }
+            gfx.fillEllipse(x - leafSize, y - leafYOffset, leafSize, static_cast<int>(leafSize * 0.6));
+            gfx.fillEllipse(x + leafSize, y - leafYOffset, leafSize, static_cast<int>(leafSize * 0.6));
+        }
+    }
 
-            // Left leaf - angled outward
-            fillellipse(x - leafSize, y - leafYOffset, leafSize, static_cast<int>(leafSize * 0.6));
+    // Incremental growth mode. Every segment grows to its full length (scale
+    // 1) and then stays where it is, so while the tree grows in place
+    // (inLayer) the finished segments are drawn into a layer, which is only
+    // redrawn when another level finishes, and each frame rasterizes just the
+    // segments still growing. Finished segments go under growing ones and
+    // flowers on top whether or not the layer is used, so both give the same
+    // pixels. The layer is keyed on where toScreen puts the trunk base.
+    void drawGrowingTree(const ViewTransform &toScreen, int trunkLength, double growth, bool inLayer)
+    {
+        double angle = 3.14159 / 2;
+        int depth = drawnDepth(), leaves = governor.quality().leavesPerTip;
+        if (!branchGeometry.matches(*grammar, leafSeed, trunkLength, angle, depth, 1.0, growth, leaves))
+            branchGeometry.build(*grammar, leafSeed, trunkLength, angle, depth, 1.0, growth, leaves);
 
-            // Right leaf - angled outward
-            fillellipse(x + leafSize, y - leafYOffset, leafSize, static_cast<int>(leafSize * 0.6));
+        if (inLayer)
+        {
+            int originX, originY;
+            toScreen.map(0.0f, 0.0f, originX, originY);
+            long long grown = std::count(branchGeometry.grown.begin(), branchGeometry.grown.end(), 1);
+            unsigned long long key = (static_cast<unsigned long long>(mixBits(leafSeed ^ mixBits(originX * 4099u + originY))) << 32) ^
+                                     (static_cast<unsigned long long>(trunkLength) << 20) ^ static_cast<unsigned long long>(grown);
+            if (!gfx.layerCurrent(LAYER_TREE, key))
+            {
+                gfx.beginLayer(LAYER_TREE, key);
+                drawBranchGeometry(gfx, branchGeometry, toScreen, false, 0.0, Segments::GROWN);
+                gfx.endLayer();
+                treeLayerBuilds++;
+            }
+            gfx.drawLayer(LAYER_TREE, LayerArea::FULL);
+            treeLayerShown = true;
+        }
+        else
+        {
+            drawBranchGeometry(gfx, branchGeometry, toScreen, false, 0.0, Segments::GROWN);
         }
+        drawBranchGeometry(gfx, branchGeometry, toScreen, false, 0.0, Segments::GROWING);
+
+        if (view.showFlowers)
+        {
+            for (size_t i = 0; i < branchGeometry.size(); i++)
+            {
+                if (!branchGeometry.flowerTip[i])
+                    continue;
+                int x, y;
+                toScreen.map(branchGeometry.x2[i], branchGeometry.y2[i], x, y);
+                drawFlower(gfx, x, y, view.flowerScale);
+            }
+        }
+    }
+
+    // Render impostor `index` of the forest: the tree drawn whole into an
+    // offscreen framebuffer sized to its crown, `block` times bigger than it
+    // appears, then shrunk to size
+    Stamp buildImpostor(int index)
+    {
+        int row;
+        double growth, flowerScale;
+        unsigned int variant;
+        Forest::impostorStage(index, row, growth, flowerScale, variant);
+        double rowScale = Forest::rowScale(row);
+        int block = std::max(1, static_cast<int>(1.0 / rowScale));
+        int trunkLength = static_cast<int>(150 * rowScale * block);
+        forestGeometry.build(*grammar, mixBits(leafSeed + variant), trunkLength, 3.14159 / 2, grammarDepth, growth, growth);
+        if (forestGeometry.size() == 0)
+            return Stamp();
+
+        int reach = flowerScale > 0 ? static_cast<int>(8 * flowerScale) + 1 : 0;
+        int left = static_cast<int>(std::floor(forestGeometry.boxLeft[0])) - reach;
+        int top = static_cast<int>(std::floor(forestGeometry.boxTop[0])) - reach;
+        int w = static_cast<int>(std::ceil(forestGeometry.boxRight[0])) + reach - left + 1;
+        int h = static_cast<int>(std::ceil(forestGeometry.boxBottom[0])) + reach - top + 1;
+        FramebufferBackend canvas;
+        canvas.setBackground(0); // transparent, so only the tree ends up in the stamp
+        canvas.initialize(w, h, "impostor");
+        ClipRect canvasArea = {0, 0, w, h};
+        drawBranchGeometry(canvas, forestGeometry, ViewTransform::translate(-left, -top), flowerScale > 0, flowerScale, Segments::ALL, &canvasArea);
+        return Forest::shrinkToStamp(canvas.data(), w, h, -left, -top, block);
+    }
+
+    // Forest mode: the rows from the horizon forward. In each row the trees
+    // small enough for an impostor go first, batched into one stamps() call
+    // per impostor, then the rest as branches, full depth if they are big.
+    void drawForest()
+    {
+        PROFILE_SCOPE(DRAW_BRANCH);
+
+        struct ImpostorDraw
+        {
+            int index, x, y;
+        };
+
+        double seconds = viewSeconds();
+        double cameraX = seconds * FOREST_SCROLL;
+        forestVisible = 0;
+        forestFrames++;
+        for (int row = 0; row < Forest::ROWS; row++)
+        {
+            double rowScale = Forest::rowScale(row);
+            int baseY = Forest::rowBase(row, groundLevel, screenHeight);
+            int margin = static_cast<int>(320 * rowScale) + 10; // half a full-grown tree, plus flowers
+
+            FrameList<ImpostorDraw> impostors(frameArena);
+            FrameList<Forest::TreeView> detailed(frameArena);
+            forest->forEachVisible(row, seconds, cameraX, screenWidth, margin, [&](const Forest::TreeView &tree) {
+                if (tree.growth <= 0.01)
+                    return;
+                forestVisible++;
+                if (Forest::detailFor(150 * rowScale * tree.growth) == Forest::IMPOSTOR)
+                    impostors.push_back({Forest::impostorIndex(row, tree.growth, tree.flowerScale, tree.tree->seed), tree.screenX, baseY});
+                else
+                    detailed.push_back(tree);
+            });
+
+            if (!impostors.empty())
+            {
+                ImpostorDraw *sorted = frameArena.allocate<ImpostorDraw>(impostors.size());
+                std::copy(impostors.begin(), impostors.end(), sorted);
+                std::sort(sorted, sorted + impostors.size(), [](const ImpostorDraw &a, const ImpostorDraw &b) { return a.index < b.index; });
+                int *positions = frameArena.allocate<int>(impostors.size() * 2);
+                for (size_t i = 0; i < impostors.size(); i++)
+                {
+                    positions[i * 2] = sorted[i].x;
+                    positions[i * 2 + 1] = sorted[i].y;
+                }
+                for (size_t i = 0; i < impostors.size();)
+                {
+                    size_t end = i + 1;
+                    while (end < impostors.size() && sorted[end].index == sorted[i].index)
+                        end++;
+                    const Stamp &stamp = forest->impostor(sorted[i].index, [this](int index) { return buildImpostor(index); });
+                    gfx.stamps(stamp, static_cast<int>(end - i), positions + i * 2);
+                    i = end;
+                }
+                forestDrawn[Forest::IMPOSTOR] += impostors.size();
+            }
+
+            for (const Forest::TreeView &tree : detailed)
+            {
+                int trunkLength = static_cast<int>(150 * rowScale);
+                bool full = Forest::detailFor(trunkLength * tree.growth) == Forest::FULL;
+                int depth = std::min(full ? grammarDepth : Forest::REDUCED_DEPTH, drawnDepth());
+                forestGeometry.build(*grammar, tree.tree->seed, trunkLength, 3.14159 / 2, depth, tree.growth, tree.growth, governor.quality().leavesPerTip);
+                if (wind.strength > 0)
+                {
+                    int leaves = governor.quality().leavesPerTip;
+                    ForestSway &cached = forestSways[tree.tree->index];
+                    bool restChanged = cached.frame != forestFrames - 1 || cached.depth != depth || cached.leaves != leaves ||
+                                       cached.growth != tree.growth;
+                    cached.depth = depth;
+                    cached.leaves = leaves;
+                    cached.growth = tree.growth;
+                    cached.frame = forestFrames;
+                    swayTree(forestGeometry, cached.sway, cameraX + tree.screenX, restChanged);
+                }
+                drawBranchGeometry(gfx, forestGeometry, ViewTransform::translate(tree.screenX, baseY), tree.flowerScale > 0, tree.flowerScale);
+                forestDrawn[full ? Forest::FULL : Forest::REDUCED]++;
+            }
+        }
+    }
+
+    void displayForestInfo()
+    {
+        PROFILE_SCOPE(DISPLAY_PHASE_INFO);
+
+        gfx.setColor(WHITE);
+        gfx.setTextSize(2);
+        char title[100];
+        sprintf(title, "Forest: %d trees, %d in view", static_cast<int>(forest->size()), forestVisible);
+        gfx.text(10, 10, title);
+
+        gfx.setTextSize(1);
+        char msg[] = "Press ESC to exit";
+        gfx.text(10, screenHeight - 20, msg);
     }
 
 public:
-    AnimatedTreeDrawer()
-        : screenWidth(800),
+    explicit AnimatedTreeDrawer(RenderBackend &backend)
+        : gfx(backend),
+          screenWidth(800),
           screenHeight(600),
           groundLevel(480),
-          seedX(400),
-          seedY(groundLevel + 25),
-          sunAngle(0.0),
-          treeGrowthScale(0.0),
-          flowerScale(0.0),
-          showFlowers(false),
-          animationPhase(0),
-          phaseTimer(0),
-          rightmostBranchX(0),
-          rightmostBranchY(0),
-          zoomScale(1.0),
-          cameraOffsetX(0),
-          cameraOffsetY(0) {}
+          cyclesCompleted(0),
+          renderRate(SIMULATION_HZ),
+          fixedClock(false),
+          leafSeed(1),
+          grammar(&OAK),
+          customGrammar(OAK),
+          grammarDepth(OAK.depth),
+          drawnParticles(&seedParticles),
+          seedsPerFlower(0),
+          viewAlpha(0.0),
+          useBranchCache(true),
+          smoothBranches(false),
+          incrementalGrowth(false),
+          treeLayerShown(false),
+          treeLayerBuilds(0),
+          swayNanos(0),
+          swayAttaches(0),
+          swaySegments(0),
+          useLayers(true),
+          backgroundDrawn(false),
+          backgroundSky(0),
+          culledSegments(0),
+          forestDrawn{0, 0, 0},
+          forestVisible(0),
+          forestFrames(0),
+          sprites({rgb(255, 192, 203), YELLOW, LIGHT_GREEN, rgb(160, 82, 45), rgb(100, 50, 20)}),
+          useSprites(true)
+    {
+        setSky(1, 3, 0.0);
+        resetAnimation();
+        previousSim = sim;
+        view = sim;
+    }
+
+    int getScreenWidth() const { return screenWidth; }
+    int getScreenHeight() const { return screenHeight; }
+
+    // Fall back to walking drawBranch every frame, for comparison
+    void setBranchCache(bool enabled) { useBranchCache = enabled; }
+    void setSmoothBranches(bool enabled) { smoothBranches = enabled; }
+    void setLayers(bool enabled) { useLayers = enabled; }
+    void setIncrementalGrowth(bool enabled) { incrementalGrowth = enabled; }
+    void setSprites(bool enabled) { useSprites = enabled; }
+
+    // How many suns and clouds the sky has, and how fast the clouds drift
+    // (pixels per second; 0 keeps them where they are). 1, 3 and 0 is the
+    // sky the life cycle has always had.
+    void setSky(int suns, int clouds, double drift)
+    {
+        scene = Scene::lifeCycle(screenWidth, suns, clouds, static_cast<float>(drift), 1, YELLOW, WHITE);
+        backgroundDrawn = false;
+    }
+    void setLeafSeed(unsigned int seed) { leafSeed = seed; }
+    // Sway the trees in a gusting wind of this strength (0 = still air)
+    void setWind(double strength) { wind.strength = strength; }
+
+    // Species of the single tree and how many levels to grow (0 = its own
+    // depth). The built-in species keep their compile-time rules; any other
+    // grammar is copied.
+    void setGrammar(const TreeGrammar &species, int depth = 0)
+    {
+        if (std::find(std::begin(SPECIES), std::end(SPECIES), &species) == std::end(SPECIES))
+        {
+            customGrammar = species;
+            grammar = &customGrammar;
+        }
+        else
+            grammar = &species;
+        grammarDepth = depth > 0 ? depth : grammar->depth;
+    }
+    // Seeds each flower releases when flowering ends (0 = just the one seed)
+    void setSeedsPerFlower(int count) { seedsPerFlower = count; }
+
+    // Draw `trees` trees scattered over a scrolling landscape instead of the
+    // single tree's life cycle (0 = the single tree). The land is widened with
+    // the count, so the forest is as dense with a thousand trees as with a hundred.
+    void setForest(int trees)
+    {
+        if (trees > 0)
+            forest = std::make_unique<Forest>(trees, static_cast<float>(std::max(2 * screenWidth, trees * 12)), leafSeed);
+        else
+            forest.reset();
+        forestSways.clear();
+        forestSways.resize(std::max(0, trees));
+    }
+
+    int getPhase() const { return view.animationPhase; }
+    int getCyclesCompleted() const { return cyclesCompleted; }
 
     void initialize()
     {
-        lastTime = std::chrono::steady_clock::now();
-        initwindow(screenWidth, screenHeight, "Animated Tree Life Cycle");
-        setbkcolor(SKY_BLUE);
-        cleardevice();
-        setactivepage(0);
-        setvisualpage(0);
+        gfx.initialize(screenWidth, screenHeight, "Animated Tree Life Cycle");
+        // A sprite costs a call per span where the backend cannot copy it
+        useSprites = useSprites && gfx.fastStamps();
+        if (useSprites)
+            sprites.build();
+        gfx.setBackground(SKY_BLUE);
+        gfx.clear();
     }
 
     void resetAnimation()
     {
-        treeGrowthScale = 0.0;
-        flowerScale = 0.0;
-        showFlowers = false;
-        animationPhase = 0;
-        phaseTimer = 0;
-        fallingSeeds.clear();
-        seedX = screenWidth / 2;
-        seedY = groundLevel + 25;
-        zoomScale = 1.0;
-        cameraOffsetX = 0;
-        cameraOffsetY = 0;
-        flowerPositions.clear();
-        rightmostBranchX = 0;
-        rightmostBranchY = 0;
+        seedParticles.clear();
+        sim.treeGrowthScale = 0.0;
+        sim.flowerScale = 0.0;
+        sim.showFlowers = false;
+        sim.animationPhase = 0;
+        sim.phaseTimer = 0;
+        sim.fallingSeeds.clear();
+        sim.seedX = screenWidth / 2;
+        sim.seedY = groundLevel + 25;
+        sim.zoomScale = 1.0;
+        sim.cameraOffsetX = 0;
+        sim.cameraOffsetY = 0;
     }
 
+    // Advance the simulation by exactly one fixed tick (SIMULATION_DT)
     void update()
     {
-        phaseTimer += 2;
+        PROFILE_SCOPE(UPDATE);
+
+        sim.tick++;
+        sim.phaseTimer += 2;
 
-        switch (animationPhase)
+        switch (sim.animationPhase)
         {
         case 0: // Seed germination (0-40 frames)
-            if (phaseTimer < 40)
+            if (sim.phaseTimer < 40)
             {
-                treeGrowthScale = 0.0;
+                sim.treeGrowthScale = 0.0;
             }
             else
             {
-                animationPhase = 1;
-                phaseTimer = 0;
+                sim.animationPhase = 1;
+                sim.phaseTimer = 0;
             }
             break;
 
         case 1:
         { // Leaf phase (0-60 frames) - grows smoothly
-            if (phaseTimer < 60)
+            if (sim.phaseTimer < 60)
             {
                 // Don't set to 0, let it transition smoothly
-                treeGrowthScale = std::min(0.15, phaseTimer / 400.0); // Very gradual start
+                sim.treeGrowthScale = std::min(0.15, sim.phaseTimer / 400.0); // Very gradual start
             }
             else
             {
-                animationPhase = 2;
-                phaseTimer = 0;
+                sim.animationPhase = 2;
+                sim.phaseTimer = 0;
             }
             break;
         }
 
         case 2:
         { // Tree growth (0-100 frames)
-            if (phaseTimer < 100)
+            if (sim.phaseTimer < 100)
             {
-                treeGrowthScale = 0.15 + (phaseTimer / 100.0) * 0.85; // Continue from 0.15
+                sim.treeGrowthScale = 0.15 + (sim.phaseTimer / 100.0) * 0.85; // Continue from 0.15
             }
             else
             {
-                animationPhase = 3;
-                phaseTimer = 0;
-                showFlowers = true;
+                sim.animationPhase = 3;
+                sim.phaseTimer = 0;
+                sim.showFlowers = true;
             }
             break;
         }
 
         case 3:
         { // Flowering (0-25 frames)
-            if (phaseTimer < 25)
+            if (sim.phaseTimer < 25)
             {
-                flowerScale = phaseTimer / 25.0;
+                sim.flowerScale = sim.phaseTimer / 25.0;
             }
             else
             {
-                animationPhase = 4;
-                phaseTimer = 0;
+                sim.animationPhase = 4;
+                sim.phaseTimer = 0;
 
-                // Create seed at rightmost branch tip (where flowers are)
+                // Create seed at rightmost branch tip (where flowers are), taken from
+                // the tree as it stands at zoom 1, so it does not depend on rendering
+                tipGeometry.build(*grammar, leafSeed, 150, 3.14159 / 2, grammarDepth, sim.treeGrowthScale, sim.treeGrowthScale);
                 Seed newSeed;
-                newSeed.x = rightmostBranchX > 0 ? rightmostBranchX : seedX + 100;
-                newSeed.y = rightmostBranchY > 0 ? rightmostBranchY : groundLevel - 150;
+                newSeed.x = tipGeometry.hasRightmostTip ? sim.seedX + tipGeometry.rightmostTipX : sim.seedX + 100;
+                newSeed.y = tipGeometry.hasRightmostTip ? groundLevel + tipGeometry.rightmostTipY : groundLevel - 150;
                 newSeed.angle = 0;
                 newSeed.velocityY = 0;
                 newSeed.active = true;
-                fallingSeeds.clear();
-                fallingSeeds.push_back(newSeed);
+                sim.fallingSeeds.clear();
+                sim.fallingSeeds.push_back(newSeed);
+
+                if (seedsPerFlower > 0)
+                {
+                    unsigned int flower = 0;
+                    for (size_t i = 0; i < tipGeometry.size(); i++)
+                    {
+                        if (tipGeometry.flowerTip[i])
+                            seedParticles.emit(static_cast<float>(sim.seedX + tipGeometry.x2[i]), static_cast<float>(groundLevel + tipGeometry.y2[i]),
+                                               seedsPerFlower, leafSeed, flower++);
+                    }
+                }
             }
             break;
         }
@@ -460,168 +991,249 @@ public:
             updateFallingSeeds();
 
             // Get the falling seed position
-            if (!fallingSeeds.empty() && fallingSeeds[0].active)
+            if (!sim.fallingSeeds.empty() && sim.fallingSeeds[0].active)
             {
-                Seed &seed = fallingSeeds[0];
+                Seed &seed = sim.fallingSeeds[0];
 
                 // Moderate zoom - 1x to 8x (reduced from 25x)
-                if (phaseTimer < 60)
+                if (sim.phaseTimer < 60)
                 {
-                    zoomScale = 1.0 + (phaseTimer / 55.0) * 7.0;
+                    sim.zoomScale = 1.0 + (sim.phaseTimer / 55.0) * 7.0;
 
-                    cameraOffsetX = screenWidth / 2 - static_cast<int>(seed.x * zoomScale);
-                    cameraOffsetY = screenHeight / 2 - static_cast<int>(seed.y * zoomScale);
+                    sim.cameraOffsetX = screenWidth / 2 - static_cast<int>(seed.x * sim.zoomScale);
+                    sim.cameraOffsetY = screenHeight / 2 - static_cast<int>(seed.y * sim.zoomScale);
                 }
             }
             else
             {
                 // Seed has landed - hold zoom on the seed in ground
-                if (phaseTimer < 90)
+                if (sim.phaseTimer < 90)
                 {
                     // Keep zoomed on seed in ground for a moment
-                    zoomScale = 8.0;
-                    cameraOffsetX = screenWidth / 2 - static_cast<int>(seedX * zoomScale);
-                    cameraOffsetY = screenHeight / 2 - static_cast<int>(seedY * zoomScale);
+                    sim.zoomScale = 8.0;
+                    sim.cameraOffsetX = screenWidth / 2 - static_cast<int>(sim.seedX * sim.zoomScale);
+                    sim.cameraOffsetY = screenHeight / 2 - static_cast<int>(sim.seedY * sim.zoomScale);
                 }
             }
 
             bool allFallen = true;
-            for (const auto &seed : fallingSeeds)
+            for (const auto &seed : sim.fallingSeeds)
             {
                 if (seed.active)
                     allFallen = false;
             }
 
             // Wait a bit after seed lands before zooming out
-            if (allFallen && phaseTimer > 90)
+            if (allFallen && sim.phaseTimer > 90)
             {
-                animationPhase = 5;
-                phaseTimer = 0;
+                sim.animationPhase = 5;
+                sim.phaseTimer = 0;
             }
             break;
         }
 
         case 5:
         { // Zoom out from seed in ground to initial view
-            if (phaseTimer < 50)
+            if (sim.phaseTimer < 50)
             {
                 // Fade out old tree
-                treeGrowthScale = 1.0 - (phaseTimer / 50.0);
-                flowerScale = 1.0 - (phaseTimer / 50.0);
+                sim.treeGrowthScale = 1.0 - (sim.phaseTimer / 50.0);
+                sim.flowerScale = 1.0 - (sim.phaseTimer / 50.0);
 
                 // Zoom out from 8x back to 1x
-                double zoomProgress = phaseTimer / 50.0;
-                zoomScale = 8.0 - (zoomProgress * 7.0);
+                double zoomProgress = sim.phaseTimer / 50.0;
+                sim.zoomScale = 8.0 - (zoomProgress * 7.0);
 
                 // Move camera from seed position back to center
                 int targetOffsetX = 0;
                 int targetOffsetY = 0;
-                int startOffsetX = screenWidth / 2 - static_cast<int>(seedX * 8.0);
-                int startOffsetY = screenHeight / 2 - static_cast<int>(seedY * 8.0);
+                int startOffsetX = screenWidth / 2 - static_cast<int>(sim.seedX * 8.0);
+                int startOffsetY = screenHeight / 2 - static_cast<int>(sim.seedY * 8.0);
 
-                cameraOffsetX = startOffsetX + static_cast<int>((targetOffsetX - startOffsetX) * zoomProgress);
-                cameraOffsetY = startOffsetY + static_cast<int>((targetOffsetY - startOffsetY) * zoomProgress);
+                sim.cameraOffsetX = startOffsetX + static_cast<int>((targetOffsetX - startOffsetX) * zoomProgress);
+                sim.cameraOffsetY = startOffsetY + static_cast<int>((targetOffsetY - startOffsetY) * zoomProgress);
             }
             else
             {
                 resetAnimation();
+                cyclesCompleted++;
             }
             break;
         }
         }
-        auto currentTime = std::chrono::steady_clock::now();
-        double elapsedSeconds = std::chrono::duration<double>(currentTime - lastTime).count();
-        lastTime = currentTime;
 
-        sunAngle += 0.5 * elapsedSeconds; // radians per second
-        if (sunAngle > 2 * 3.14159)
-            sunAngle -= 2 * 3.14159;
+        sim.sunAngle += 0.5 * SIMULATION_DT; // radians per second
+        if (sim.sunAngle > 2 * 3.14159)
+            sim.sunAngle -= 2 * 3.14159;
+
+        if (seedParticles.size() > 0)
+            seedParticles.step(static_cast<float>(groundLevel));
+    }
+
+    // Bring the simulation up to `ticks` (plus `alpha` of the next tick) and
+    // store the state to draw in `out`. Time only moves forward.
+    void simulateTo(long long ticks, double alpha, TreeState &out)
+    {
+        long long needed = ticks + (alpha > 0 ? 1 : 0);
+        while (sim.tick < needed)
+        {
+            previousSim = sim;
+            update();
+        }
+        if (alpha > 0)
+            interpolateState(previousSim, sim, alpha, out);
+        else
+            out = sim;
+    }
+
+    // As simulateTo, refreshing the view that render() draws
+    void advanceTo(long long ticks, double alpha)
+    {
+        simulateTo(ticks, alpha, view);
+        viewAlpha = alpha;
     }
 
+    // Draw one frame and tell the governor how long it took
     void render()
     {
-        setactivepage(1 - getactivepage());
-        int r = 100 - static_cast<int>(50 * -sin(sunAngle));
-        int g = 170 - static_cast<int>(100 * -sin(sunAngle));
-        int b = 200 - static_cast<int>(80 * -sin(sunAngle));
+        auto renderStart = std::chrono::steady_clock::now();
+        drawFrame();
+        governor.frameDone(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - renderStart).count());
+    }
+
+    void drawFrame()
+    {
+        frameArena.reset();
+        wind.time = viewSeconds();
+        scene.updateOrbits(view.sunAngle);
+        scene.updateDrift(viewSeconds());
+        gfx.beginFrame();
+        int r = 100 - static_cast<int>(50 * -sin(view.sunAngle));
+        int g = 170 - static_cast<int>(100 * -sin(view.sunAngle));
+        int b = 200 - static_cast<int>(80 * -sin(view.sunAngle));
         r = std::max(0, std::min(255, r));
         g = std::max(0, std::min(255, g));
         b = std::max(0, std::min(255, b));
 
-        setbkcolor(COLOR(r, g, b));
-        cleardevice();
+        double drawOffsetX = view.cameraOffsetX;
+        double drawOffsetY = view.cameraOffsetY;
 
-        drawSun();
-        drawClouds();
+        if (forest)
+        {
+            drawBackground(rgb(r, g, b), groundLevel);
+            drawForest();
+            displayForestInfo();
+            gfx.endFrame();
+            return;
+        }
+
+        // The tree layer stays valid while the tree grows in place (phases
+        // 1-3, before the camera moves). Its pixels never count as dirty, so
+        // the first frame without it repaints the whole background.
+        bool treeInLayer = incrementalGrowth && useLayers && gfx.supportsLayers() && view.animationPhase >= 1 && view.animationPhase <= 3 &&
+                           view.zoomScale == 1.0 && drawOffsetX == 0 && drawOffsetY == 0;
+        if (treeLayerShown && !treeInLayer)
+            backgroundDrawn = false;
+        treeLayerShown = false;
 
-        int drawOffsetX = cameraOffsetX;
-        int drawOffsetY = cameraOffsetY;
+        int transformedGroundLevel = groundLevel + static_cast<int>(drawOffsetY);
+        drawBackground(rgb(r, g, b), transformedGroundLevel);
 
-        int transformedGroundLevel = groundLevel + drawOffsetY;
-        int originalGroundLevel = groundLevel;
-        groundLevel = transformedGroundLevel;
-        drawSoil();
-        groundLevel = originalGroundLevel;
+        // World to screen for the seed, the seedling and the tree: shift by
+        // the camera offset, then zoom about the centre of the screen
+        ViewTransform camera = ViewTransform::zoomAbout(view.zoomScale, drawOffsetX, drawOffsetY, screenWidth / 2.0, screenHeight / 2.0);
 
         // Draw seed underground
-        if (animationPhase <= 1)
+        if (view.animationPhase <= 1)
         {
-            double seedScale = 1.0 + (animationPhase == 0 ? phaseTimer / 20.0 : 2.0);
-            int seedDrawX = static_cast<int>((seedX + drawOffsetX) * zoomScale - (zoomScale - 1.0) * screenWidth / 2);
-            int seedDrawY = static_cast<int>((seedY + drawOffsetY) * zoomScale - (zoomScale - 1.0) * screenHeight / 2);
-            drawSeed(seedDrawX, seedDrawY, 0, seedScale * zoomScale);
+            double seedScale = 1.0 + (view.animationPhase == 0 ? view.phaseTimer / 20.0 : 2.0);
+            int seedDrawX, seedDrawY;
+            camera.map(static_cast<float>(view.seedX), static_cast<float>(view.seedY), seedDrawX, seedDrawY);
+            drawSeed(seedDrawX, seedDrawY, 0, seedScale * view.zoomScale);
 
             // Draw sprout ONLY during germination and ONLY when seed has started growing
-            if (animationPhase == 0 && phaseTimer > 20)
+            if (view.animationPhase == 0 && view.phaseTimer > 20)
             { // Start after 20 frames
-                setcolor(LIGHT_GREEN);
-                double sproutProgress = (phaseTimer - 20) / 20.0; // Progress from 0 to 1
-                int sproutLength = static_cast<int>(sproutProgress * 20 * zoomScale);
-                line(seedDrawX, seedDrawY, seedDrawX, seedDrawY - sproutLength);
+                gfx.setColor(LIGHT_GREEN);
+                double sproutProgress = (view.phaseTimer - 20) / 20.0; // Progress from 0 to 1
+                int sproutLength = static_cast<int>(sproutProgress * 20 * view.zoomScale);
+                gfx.line(seedDrawX, seedDrawY, seedDrawX, seedDrawY - sproutLength);
             }
         }
 
         // MORPHING STAGES - all drawn together for smooth transition
 
         // Stage 1: Seedling stem and leaves (phases 1)
-        if (animationPhase == 1)
+        if (view.animationPhase == 1)
         {
-            double leafProgress = phaseTimer / 60.0;
-
-            int leafDrawX = static_cast<int>((seedX + drawOffsetX) * zoomScale - (zoomScale - 1.0) * screenWidth / 2);
+            double leafProgress = view.phaseTimer / 60.0;
 
             // 🔥 FIX: interpolate Y from seed position to ground level
-            double baseY = seedY + leafProgress * (groundLevel - seedY);
+            double baseY = view.seedY + leafProgress * (groundLevel - view.seedY);
 
-            int leafDrawY = static_cast<int>((baseY + drawOffsetY) * zoomScale - (zoomScale - 1.0) * screenHeight / 2);
+            int leafDrawX, leafDrawY;
+            camera.map(static_cast<float>(view.seedX), static_cast<float>(baseY), leafDrawX, leafDrawY);
 
             drawSeedlingLeaves(leafDrawX, leafDrawY, leafProgress);
         }
 
         // Stage 2-3: Tree (overlaps with leaves at start of phase 2 for smooth transition)
-        if (animationPhase >= 2 || (animationPhase == 1 && phaseTimer > 50))
+        if (view.animationPhase >= 2 || (view.animationPhase == 1 && view.phaseTimer > 50))
         {
             // Calculate blend factor for smooth transition
             double blendFactor = 1.0;
-            if (animationPhase == 1)
+            if (view.animationPhase == 1)
             {
-                blendFactor = (phaseTimer - 50) / 10.0; // Fade in tree during last 10 frames of leaf stage
+                blendFactor = (view.phaseTimer - 50) / 10.0; // Fade in tree during last 10 frames of leaf stage
             }
 
-            int startX = static_cast<int>((seedX + drawOffsetX) * zoomScale - (zoomScale - 1.0) * screenWidth / 2);
-            int startY = static_cast<int>((groundLevel + drawOffsetY) * zoomScale - (zoomScale - 1.0) * screenHeight / 2);
-            int trunkLength = static_cast<int>(150 * zoomScale);
+            // The tree is built at world size with its trunk base at the
+            // origin, so the camera can zoom it without a rebuild
+            ViewTransform treeView = camera * ViewTransform::translate(view.seedX, groundLevel);
+            int trunkLength = 150;
             double initialAngle = 3.14159 / 2;
 
-            // Use actual treeGrowthScale which transitions smoothly
-            if (treeGrowthScale > 0.01)
+            // Use actual view.treeGrowthScale which transitions smoothly
+            if (view.treeGrowthScale > 0.01)
             {
-                drawBranch(startX, startY, trunkLength, initialAngle, 8, treeGrowthScale * blendFactor, treeGrowthScale * blendFactor);
+                PROFILE_SCOPE(DRAW_BRANCH);
+                double growth = view.treeGrowthScale * blendFactor;
+                if (incrementalGrowth)
+                {
+                    drawGrowingTree(treeView, trunkLength, growth, treeInLayer);
+                }
+                else if (useBranchCache)
+                {
+                    int depth = drawnDepth(), leaves = governor.quality().leavesPerTip;
+                    if (!branchGeometry.matches(*grammar, leafSeed, trunkLength, initialAngle, depth, growth, growth, leaves))
+                        branchGeometry.build(*grammar, leafSeed, trunkLength, initialAngle, depth, growth, growth, leaves);
+                    swayTree(branchGeometry, treeSway, view.seedX, !treeSway.isAttachedTo(branchGeometry));
+                    drawBranchGeometry(gfx, branchGeometry, treeView, view.showFlowers, view.flowerScale);
+                }
+                else
+                {
+                    int depth = drawnDepth();
+                    drawBranch(treeView, 0.0f, 0.0f, trunkLength, Direction{cos(initialAngle), sin(initialAngle)}, depth, depth, growth, growth);
+                }
             }
         }
 
+        // Released seeds, through the camera the zoom was written for (the one
+        // that keeps the falling seed at the centre): world position times
+        // zoom plus offset. `camera` applies the offset before the zoom, which
+        // is why the tree leaves the screen while zoomed; it keeps that so its
+        // frames stay as they were.
+        if (drawnParticles->size() > 0)
+        {
+            ViewTransform particleView = ViewTransform::translate(drawOffsetX, drawOffsetY) * ViewTransform::scale(view.zoomScale);
+            int stampSize = std::max(1, static_cast<int>(4 * view.zoomScale));
+            drawnParticles->draw(gfx, frameArena, viewAlpha, stampSize, screenWidth, screenHeight, [&](float wx, float wy, int &sx, int &sy) {
+                particleView.map(wx, wy, sx, sy);
+            });
+        }
+
         // Draw falling seed - zoomed and centered
-        for (const auto &seed : fallingSeeds)
+        for (const auto &seed : view.fallingSeeds)
         {
             if (seed.active)
             {
@@ -630,49 +1242,856 @@ public:
                 int centerY = screenHeight / 2;
 
                 // Draw massive rotating seed at screen center - USE seed.angle!
-                drawSeed(centerX, centerY, seed.angle, zoomScale * 2.0);
+                drawSeed(centerX, centerY, seed.angle, view.zoomScale * 2.0);
             }
         }
 
         displayPhaseInfo();
-        setvisualpage(getactivepage());
+        gfx.endFrame();
+    }
+
+    // Frame-time budget for the quality governor, in milliseconds; 0 keeps
+    // full quality whatever frames cost
+    void setFrameBudget(double ms) { governor.setBudget(ms); }
+
+    // The governor's decisions and frames per quality level
+    void reportQuality() const
+    {
+        if (governor.isEnabled())
+            governor.writeLog(stderr);
     }
 
+    // Run the simulation ahead without drawing anything
+    void fastForward(double seconds)
+    {
+        advanceTo(sim.tick + static_cast<long long>(seconds * SIMULATION_HZ), 0.0);
+    }
+
+    // Frames per second to render at; 0 renders as fast as possible. The
+    // simulation always advances at SIMULATION_HZ regardless.
+    void setRenderRate(int fps) { renderRate = fps; }
+
+    // Deterministic clock: every frame advances the simulation by exactly one
+    // frame interval (one tick when uncapped), however long it took to draw,
+    // so a window run shows the same frames as a headless one
+    void setFixedClock(bool enabled) { fixedClock = enabled; }
+
     void run()
     {
         initialize();
 
+        long long startTick = sim.tick;
+        double simulatedSeconds = 0.0;
+        auto lastFrame = std::chrono::steady_clock::now();
+
         while (true)
         {
             // Check for keyboard input
-            if (kbhit())
+            int key = gfx.pollKey();
+            if (key == 27)
+                break; // ESC to exit
+            if (key == ' ')
             {
-                char key = getch();
-                if (key == 27)
-                    break; // ESC to exit
-                if (key == ' ')
-                    resetAnimation(); // SPACE to restart
+                resetAnimation(); // SPACE to restart
+                previousSim = sim;
             }
 
-            // Update animation state
-            update();
+            // Advance by the wall-clock time since the last frame; long stalls
+            // (window drags, breakpoints) are not worth catching up on
+            auto frameStart = std::chrono::steady_clock::now();
+            if (fixedClock)
+                simulatedSeconds += 1.0 / (renderRate > 0 ? renderRate : SIMULATION_HZ);
+            else
+                simulatedSeconds += std::min(0.25, std::chrono::duration<double>(frameStart - lastFrame).count());
+            lastFrame = frameStart;
+            double ticks = simulatedSeconds * SIMULATION_HZ;
+            long long wholeTicks = static_cast<long long>(ticks);
+            advanceTo(startTick + wholeTicks, ticks - wholeTicks);
 
             // Render frame
             render();
+            PROFILE_FRAME(view.animationPhase, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - frameStart).count());
+
+            // Control frame rate
+            if (renderRate > 0)
+            {
+                double spent = std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count();
+                int remainingMs = static_cast<int>((1.0 / renderRate - spent) * 1000);
+                if (remainingMs > 0)
+                    gfx.delay(remainingMs);
+            }
+        }
+
+        gfx.shutdown();
+    }
+
+    // Pipelined run on the software framebuffer `framebuffer` (what gfx
+    // draws into), a headless harness for the split's throughput and
+    // latency. This thread polls input and runs the simulation at the
+    // render rate, publishing a snapshot of each frame's state; a render
+    // thread draws the newest snapshot and publishes a copy of the finished
+    // pixels, which go to `present` back on this thread. Both hand-offs are
+    // triple buffers, so neither thread ever waits on the other, and states
+    // the renderer cannot keep up with are skipped. Stops after `frames`
+    // presented frames (or at ESC, on a backend with keys).
+    void runPipelined(const FramebufferBackend &framebuffer, int frames, const std::function<void(const Color *)> &present)
+    {
+        initialize();
+
+        TripleBuffer<FrameSnapshot> snapshots;
+        TripleBuffer<std::vector<Color>> finished;
+        std::atomic<bool> stopping{false};
+        size_t pixelCount = static_cast<size_t>(screenWidth) * screenHeight;
+
+        std::thread renderer([&] {
+            while (!stopping.load(std::memory_order_relaxed))
+            {
+                FrameSnapshot *snapshot = snapshots.acquire();
+                if (!snapshot)
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(500));
+                    continue;
+                }
+#ifdef TREE_PROFILE
+                auto frameStart = std::chrono::steady_clock::now();
+#endif
+                view = snapshot->state;
+                viewAlpha = snapshot->alpha;
+                drawnParticles = &snapshot->particles;
+                render();
+                PROFILE_FRAME(view.animationPhase, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - frameStart).count());
+                finished.backSlot().assign(framebuffer.data(), framebuffer.data() + pixelCount);
+                finished.publish();
+            }
+        });
+
+        long long startTick = sim.tick;
+        double simulatedSeconds = 0.0;
+        int rate = renderRate > 0 ? renderRate : SIMULATION_HZ;
+        long long steps = 0;
+        auto start = std::chrono::steady_clock::now();
+        auto lastStep = start;
+        double longestStep = 0.0; // longest input + simulation step, in seconds
+        int presented = 0;
+        while (presented < frames)
+        {
+            auto stepStart = std::chrono::steady_clock::now();
+            int key = gfx.pollKey();
+            if (key == 27)
+                break;
+            if (key == ' ')
+            {
+                resetAnimation();
+                previousSim = sim;
+            }
+
+            // The fixed clock lands on the same ticks as runHeadless
+            steps++;
+            long long wholeTicks;
+            double alpha;
+            if (fixedClock)
+            {
+                long long scaled = steps * SIMULATION_HZ;
+                wholeTicks = scaled / rate;
+                alpha = static_cast<double>(scaled % rate) / rate;
+            }
+            else
+            {
+                simulatedSeconds += std::min(0.25, std::chrono::duration<double>(stepStart - lastStep).count());
+                double ticks = simulatedSeconds * SIMULATION_HZ;
+                wholeTicks = static_cast<long long>(ticks);
+                alpha = ticks - wholeTicks;
+            }
+            lastStep = stepStart;
+            FrameSnapshot &snapshot = snapshots.backSlot();
+            simulateTo(startTick + wholeTicks, alpha, snapshot.state);
+            snapshot.alpha = alpha;
+            snapshot.particles.copySeeds(seedParticles);
+            snapshots.publish();
+            longestStep = std::max(longestStep, std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count());
+
+            if (const std::vector<Color> *pixels = finished.acquire())
+            {
+                present(pixels->data());
+                presented++;
+            }
 
-            // Control frame rate (~30 FPS)
-            // Sleep(33);  // Windows Sleep uses milliseconds
-            delay(33);
+            // Uncapped still steps at the simulation rate; the renderer takes what it can
+            std::this_thread::sleep_until(stepStart + std::chrono::microseconds(1000000 / rate));
         }
+        stopping = true;
+        renderer.join();
+        drawnParticles = &seedParticles; // the snapshots are about to go
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cerr << "pipelined: " << snapshots.getPublished() << " states simulated, " << finished.getPublished() << " frames rendered ("
+                  << snapshots.getOverwritten() << " states skipped), " << presented << " presented in " << seconds
+                  << " s; longest simulation step " << longestStep * 1000 << " ms" << std::endl;
 
-        closegraph();
+        gfx.shutdown();
+    }
+
+    // Render with no pacing and report throughput. Renders `frames` frames, or
+    // with oneCycle a full life cycle (phases 0-5). Frame k shows simulation
+    // time k / renderRate seconds, so the output is the same however long
+    // each frame takes; with a render rate of 0 the wall clock is used instead,
+    // unless the clock is fixed, which then steps one tick per frame.
+    // frameDone runs after every rendered frame, e.g. to hand it to an exporter.
+    void runHeadless(int frames, bool oneCycle = false, const std::function<void()> &frameDone = nullptr)
+    {
+        initialize();
+
+        long long startTick = sim.tick;
+        int startCycles = cyclesCompleted;
+        int rate = renderRate > 0 || !fixedClock ? renderRate : SIMULATION_HZ;
+        int rendered = 0;
+#ifdef TREE_PROFILE
+        Profiler::instance().markAllocations();
+#endif
+        auto start = std::chrono::steady_clock::now();
+        while (oneCycle || rendered < frames)
+        {
+#ifdef TREE_PROFILE
+            auto frameStart = std::chrono::steady_clock::now();
+#endif
+            long long frame = rendered + 1;
+            if (rate > 0)
+            {
+                long long scaled = frame * SIMULATION_HZ;
+                advanceTo(startTick + scaled / rate, static_cast<double>(scaled % rate) / rate);
+            }
+            else
+            {
+                double ticks = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * SIMULATION_HZ;
+                long long wholeTicks = static_cast<long long>(ticks);
+                advanceTo(startTick + wholeTicks, ticks - wholeTicks);
+            }
+            if (oneCycle && cyclesCompleted > startCycles)
+                break;
+
+            render();
+            PROFILE_FRAME(view.animationPhase, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - frameStart).count());
+            rendered++;
+            if (frameDone)
+                frameDone();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cerr << rendered << " frames in " << seconds << " s ("
+                  << (seconds > 0 ? rendered / seconds : 0.0) << " fps)" << std::endl;
+        if (forest)
+            std::cerr << "forest: " << forest->size() << " trees on " << forest->getWorldWidth() << " px of land, per frame "
+                      << forestDrawn[Forest::FULL] / std::max(1, rendered) << " full, "
+                      << forestDrawn[Forest::REDUCED] / std::max(1, rendered) << " reduced, "
+                      << forestDrawn[Forest::IMPOSTOR] / std::max(1, rendered) << " impostors; "
+                      << forest->getImpostorsBuilt() << " impostors rendered" << std::endl;
+        else if (incrementalGrowth)
+            std::cerr << "incremental growth: tree layer drawn " << treeLayerBuilds << " times, branch geometry built "
+                      << branchGeometry.getBuildCount() << " times" << std::endl;
+        else if (useBranchCache)
+            std::cerr << "branch geometry built " << branchGeometry.getBuildCount() << " times, "
+                      << branchGeometry.size() << " segments in the last build, "
+                      << culledSegments << " segments culled off screen" << std::endl;
+        long long swayed = swaySegments;
+        if (swayed > 0)
+            std::cerr << "wind: " << swayed / std::max(1, rendered) << " segments swayed and "
+                      << swayAttaches / std::max(1, rendered) << " rest poses attached per frame, "
+                      << static_cast<double>(swayNanos) / swayed << " ns per segment" << std::endl;
+        if (seedsPerFlower > 0)
+            std::cerr << "seed particles: " << seedParticles.getReleased() << " released, "
+                      << seedParticles.getLanded() << " landed" << std::endl;
+#ifdef TREE_PROFILE
+        long long lastAllocating = Profiler::instance().getLastAllocatingFrame();
+        std::cerr << "heap: last allocation in frame " << lastAllocating << " of " << Profiler::instance().getFrames()
+                  << " (" << frameArena.getCapacity() << " byte frame arena, grown " << frameArena.getGrowCount() << " times)" << std::endl;
+#endif
+
+        gfx.shutdown();
     }
 };
 
-int main()
+static void printUsage(const char *program)
+{
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --headless         render offscreen into a software framebuffer\n"
+              << "  --frames N         number of frames to render headless (default 600)\n"
+              << "  --cycle            render exactly one life cycle (phases 0-5) instead of --frames\n"
+              << "  --fps N            render rate (default 30, 0 = uncapped); the simulation always runs at 30 Hz\n"
+              << "  --fast-forward S   simulate S seconds without rendering before the first frame\n"
+              << "  --snapshot FILE    write the last headless frame as a binary PPM\n"
+              << "  --export FILE      stream every headless frame to FILE ('-' for stdout)\n"
+              << "  --format y4m|ppm   export format (default: from the file extension, else y4m)\n"
+              << "  --shm-ring NAME    publish every headless frame into the POSIX shared-memory ring NAME (e.g. /tree-frames)\n"
+              << "  --shm-slots N      frames the ring holds (default 4)\n"
+              << "  --shm-policy drop|block  when the consumer falls behind, overwrite its oldest frame (default) or wait for it\n"
+              << "  --shm-replace      take over the --shm-ring name if a ring of that name is left over (e.g. from a killed run)\n"
+              << "  --immediate-branches  re-walk drawBranch every frame instead of the cached geometry\n"
+              << "  --aa-branches      anti-alias the branch edges\n"
+              << "  --no-layers        redraw sky, clouds and soil every frame instead of caching them\n"
+              << "  --incremental-growth  grow segments to full length and keep finished ones in a layer\n"
+              << "  --exact-sprites    rasterize flowers, leaves and seeds every time instead of using the sprite atlas\n"
+              << "  --threads N        rasterize headless frames in screen tiles on N threads\n"
+              << "  --record           record each frame into a command buffer and replay it sorted by colour and width\n"
+              << "  --replay N         with --record, present the last frame N more times without the scene and time it\n"
+              << "  --pipelined        headless harness: simulate and render on two threads, handing frames to --export through triple buffers\n"
+              << "  --profile-out FILE write instrumentation (CSV, or JSON for *.json) at exit; needs make PROFILE=1\n"
+              << "  --frame-budget MS  lower the detail while frames take longer than MS (0 = off; default 1000/fps in a window, off headless)\n"
+              << "  --fixed-clock      advance one frame interval per frame instead of following the wall clock\n"
+              << "  --seed N           seed for the leaf placement (default 1)\n"
+              << "  --species NAME     grow an oak (default), pine, birch or shrub\n"
+              << "  --grammar RULES    grow children angle:factor,angle:factor,... (radians, length factor) instead of the species'\n"
+              << "  --depth N          levels of the tree to grow (default: the species', oak 8)\n"
+              << "  --suns N           suns spaced around the sun's orbit (default 1)\n"
+              << "  --clouds N         clouds in the sky, the first three where they always were (default 3)\n"
+              << "  --cloud-drift PX   move the clouds PX pixels per second, wrapping around (default 0, still and cached)\n"
+              << "  --wind S           sway the trees in a gusting wind of strength S (1 = a breeze; default 0, still)\n"
+              << "  --seed-particles N every flower releases N seeds when flowering ends\n"
+              << "  --forest N         draw a scrolling forest of N trees instead of the single tree\n"
+              << "  --golden FILE      render one cycle, check frame hashes against FILE and report frame times\n"
+              << "  --golden-update FILE  as --golden, but rewrite FILE with this build's hashes\n"
+              << "  --bench-fill       benchmark the scalar/SSE2/AVX2 span fillers and exit\n"
+              << "  --bench-particles N  time N falling seeds at 60 fps (tick and batched draw) and exit\n"
+              << "  --bench-trig       time the trig tables and incremental branch rotation against libm and exit\n"
+              << "  --bench-grammar    time building each species at depths 1-12, compile-time rules against run-time, and exit\n"
+              << "  --bench-sway       time swaying the oak at depths 8, 10 and 12 per segment and exit\n"
+              << "  --bench-lines      time drawing the oak's branches at depths 8, 10 and 12 with line() and lines(), and exit\n"
+              << "  --bench-scene      time the scene's update and render systems for 100 to 100000 drifting clouds and suns, and exit\n";
+}
+
+static bool writeProfile(const char *path)
+{
+#ifdef TREE_PROFILE
+    if (path && !Profiler::instance().write(path))
+    {
+        std::cerr << "Could not write " << path << std::endl;
+        return false;
+    }
+#else
+    (void)path;
+#endif
+    return true;
+}
+
+// Golden-frame check: render one life cycle at 30 fps from a fresh start and
+// compare the hashes of selected frames with the values stored in `path`
+// (lines of "frame hash", '#' starts a comment). With update the file is
+// rewritten from this build instead, keeping its frame list. Each selected
+// frame's render time (best of a few repeats) and every phase's mean and
+// worst frame time are printed too, so one run catches changes in output
+// and in speed.
+static bool checkGolden(AnimatedTreeDrawer &drawer, const FramebufferBackend &framebuffer, const char *path, bool update)
+{
+    const int REPEATS = 5;
+    std::vector<long long> frames;
+    std::vector<unsigned long long> expected;
+    if (FILE *file = std::fopen(path, "r"))
+    {
+        char line[256];
+        while (std::fgets(line, sizeof(line), file))
+        {
+            long long frame;
+            unsigned long long hash;
+            if (line[0] != '#' && std::sscanf(line, "%lld %llx", &frame, &hash) == 2)
+            {
+                frames.push_back(frame);
+                expected.push_back(hash);
+            }
+        }
+        std::fclose(file);
+    }
+    else if (!update)
+    {
+        std::cerr << "Could not read " << path << std::endl;
+        return false;
+    }
+    if (frames.empty())
+    {
+        // Two frames from each phase of the cycle
+        frames = {8, 16, 25, 45, 60, 95, 104, 111, 125, 160, 170, 189};
+        expected.assign(frames.size(), 0);
+    }
+
+    std::vector<unsigned long long> actual(frames.size(), 0);
+    double phaseTotal[PHASE_COUNT] = {}, phaseWorst[PHASE_COUNT] = {};
+    int phaseFrames[PHASE_COUNT] = {};
+    int mismatches = 0;
+
+    std::printf("%6s  %-11s  %-16s  %-8s  %8s\n", "frame", "phase", "hash", "result", "ms");
+    drawer.initialize();
+    size_t next = 0;
+    for (long long frame = 1;; frame++)
+    {
+        drawer.advanceTo(frame, 0.0);
+        if (drawer.getCyclesCompleted() > 0)
+            break;
+
+        auto start = std::chrono::steady_clock::now();
+        drawer.render();
+        double ms = secondsSince(start) * 1000.0;
+        int phase = drawer.getPhase();
+        phaseTotal[phase] += ms;
+        phaseWorst[phase] = std::max(phaseWorst[phase], ms);
+        phaseFrames[phase]++;
+
+        if (next < frames.size() && frames[next] == frame)
+        {
+            for (int i = 1; i < REPEATS; i++)
+            {
+                start = std::chrono::steady_clock::now();
+                drawer.render();
+                ms = std::min(ms, secondsSince(start) * 1000.0);
+            }
+            actual[next] = framebuffer.hash();
+            const char *result = update ? "updated" : actual[next] == expected[next] ? "ok" : "MISMATCH";
+            if (!update && actual[next] != expected[next])
+                mismatches++;
+            std::printf("%6lld  %-11s  %016llx  %-8s  %8.3f\n", frame, phaseName(phase), actual[next], result, ms);
+            next++;
+        }
+    }
+    for (; next < frames.size(); next++)
+    {
+        std::printf("%6lld  (past the end of the cycle)\n", frames[next]);
+        mismatches++;
+    }
+
+    std::printf("\n%-11s  %6s  %8s  %8s\n", "phase", "frames", "mean ms", "max ms");
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        if (phaseFrames[p] > 0)
+            std::printf("%-11s  %6d  %8.3f  %8.3f\n", phaseName(p), phaseFrames[p], phaseTotal[p] / phaseFrames[p], phaseWorst[p]);
+    }
+
+    if (update)
+    {
+        FILE *file = std::fopen(path, "w");
+        if (!file)
+        {
+            std::cerr << "Could not write " << path << std::endl;
+            return false;
+        }
+        std::fprintf(file, "# Golden frame hashes for --golden: frame number at 30 fps from a fresh\n"
+                           "# start, then the FNV-1a hash of its pixels. Regenerate with --golden-update.\n");
+        for (size_t i = 0; i < frames.size(); i++)
+            std::fprintf(file, "%lld %016llx\n", frames[i], actual[i]);
+        if (std::fclose(file) != 0)
+        {
+            std::cerr << "Could not write " << path << std::endl;
+            return false;
+        }
+        std::printf("wrote %zu hashes to %s\n", frames.size(), path);
+        return true;
+    }
+    std::printf("golden frames: %zu checked, %d mismatched\n", frames.size(), mismatches);
+    return mismatches == 0;
+}
+
+int main(int argc, char **argv)
 {
-    AnimatedTreeDrawer drawer;
+#ifdef HEADLESS
+    bool headless = true;
+#else
+    bool headless = false;
+#endif
+    int frames = 600;
+    const char *snapshotPath = nullptr;
+    const char *exportPath = nullptr;
+    const char *exportFormat = nullptr;
+    const char *ringName = nullptr;
+    int suns = 1, clouds = 3;
+    double cloudDrift = 0.0;
+    int ringSlots = 4;
+    bool ringBlocks = false;
+    bool ringReplace = false;
+    bool oneCycle = false;
+    int renderRate = 30;
+    const char *profilePath = nullptr;
+    double fastForwardSeconds = 0.0;
+    bool branchCache = true;
+    bool smoothBranches = false;
+    bool layers = true;
+    bool incrementalGrowth = false;
+    bool sprites = true;
+    int threads = 0;
+    bool record = false;
+    int replays = 0;
+    bool pipelined = false;
+    bool fixedClock = false;
+    double frameBudget = -1.0; // not given
+    unsigned int leafSeed = 1;
+    const TreeGrammar *species = &OAK;
+    TreeGrammar grammar = OAK;
+    bool customRules = false;
+    int treeDepth = 0;
+    int seedsPerFlower = 0;
+    double windStrength = 0.0;
+    int forestTrees = 0;
+    const char *goldenPath = nullptr;
+    bool updateGolden = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc)
+            snapshotPath = argv[++i];
+        else if (std::strcmp(argv[i], "--cycle") == 0)
+            oneCycle = true;
+        else if (std::strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+            renderRate = std::max(0, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--fast-forward") == 0 && i + 1 < argc)
+            fastForwardSeconds = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+            exportPath = argv[++i];
+        else if (std::strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+        {
+            exportFormat = argv[++i];
+            if (std::strcmp(exportFormat, "y4m") != 0 && std::strcmp(exportFormat, "ppm") != 0)
+            {
+                std::cerr << "Unknown --format " << exportFormat << " (want y4m or ppm)" << std::endl;
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--shm-ring") == 0 && i + 1 < argc)
+            ringName = argv[++i];
+        else if (std::strcmp(argv[i], "--shm-slots") == 0 && i + 1 < argc)
+            ringSlots = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--shm-policy") == 0 && i + 1 < argc)
+        {
+            ++i;
+            if (std::strcmp(argv[i], "drop") != 0 && std::strcmp(argv[i], "block") != 0)
+            {
+                std::cerr << "Unknown --shm-policy " << argv[i] << " (want drop or block)" << std::endl;
+                return 1;
+            }
+            ringBlocks = std::strcmp(argv[i], "block") == 0;
+        }
+        else if (std::strcmp(argv[i], "--shm-replace") == 0)
+            ringReplace = true;
+        else if (std::strcmp(argv[i], "--immediate-branches") == 0)
+            branchCache = false;
+        else if (std::strcmp(argv[i], "--aa-branches") == 0)
+            smoothBranches = true;
+        else if (std::strcmp(argv[i], "--no-layers") == 0)
+            layers = false;
+        else if (std::strcmp(argv[i], "--incremental-growth") == 0)
+            incrementalGrowth = true;
+        else if (std::strcmp(argv[i], "--exact-sprites") == 0)
+            sprites = false;
+        else if (std::strcmp(argv[i], "--record") == 0)
+            record = true;
+        else if (std::strcmp(argv[i], "--pipelined") == 0)
+            pipelined = true;
+        else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replays = std::max(0, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--fixed-clock") == 0)
+            fixedClock = true;
+        else if (std::strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc)
+            frameBudget = std::max(0.0, std::atof(argv[++i]));
+        else if (std::strcmp(argv[i], "--seed-particles") == 0 && i + 1 < argc)
+            seedsPerFlower = std::max(0, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--wind") == 0 && i + 1 < argc)
+            windStrength = std::max(0.0, std::atof(argv[++i]));
+        else if (std::strcmp(argv[i], "--suns") == 0 && i + 1 < argc)
+            suns = std::max(0, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--clouds") == 0 && i + 1 < argc)
+            clouds = std::max(0, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--cloud-drift") == 0 && i + 1 < argc)
+            cloudDrift = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--forest") == 0 && i + 1 < argc)
+            forestTrees = std::max(0, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            leafSeed = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--species") == 0 && i + 1 < argc)
+        {
+            if (!(species = findSpecies(argv[++i])))
+            {
+                std::cerr << "Unknown species " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--grammar") == 0 && i + 1 < argc)
+        {
+            if (!parseGrammarRules(argv[++i], grammar))
+            {
+                std::cerr << "Could not read grammar " << argv[i] << " (want angle:factor,angle:factor,... with factors between 0 and 1)" << std::endl;
+                return 1;
+            }
+            customRules = true;
+        }
+        else if (std::strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+            treeDepth = std::max(1, std::min(TreeGrammar::MAX_DEPTH, std::atoi(argv[++i])));
+        else if ((std::strcmp(argv[i], "--golden") == 0 || std::strcmp(argv[i], "--golden-update") == 0) && i + 1 < argc)
+        {
+            updateGolden = std::strcmp(argv[i], "--golden-update") == 0;
+            goldenPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--profile-out") == 0 && i + 1 < argc)
+            profilePath = argv[++i];
+        else if (std::strcmp(argv[i], "--bench-fill") == 0)
+            return benchmarkSpanFill() ? 0 : 1;
+        else if (std::strcmp(argv[i], "--bench-trig") == 0)
+            return benchmarkTrig() ? 0 : 1;
+        else if (std::strcmp(argv[i], "--bench-grammar") == 0)
+            return benchmarkGrammar() ? 0 : 1;
+        else if (std::strcmp(argv[i], "--bench-sway") == 0)
+            return benchmarkSway() ? 0 : 1;
+        else if (std::strcmp(argv[i], "--bench-lines") == 0)
+            return benchmarkLines() ? 0 : 1;
+        else if (std::strcmp(argv[i], "--bench-scene") == 0)
+            return benchmarkScene() ? 0 : 1;
+        else if (std::strcmp(argv[i], "--bench-particles") == 0 && i + 1 < argc)
+            return benchmarkParticles(std::max(1, std::atoi(argv[++i]))) ? 0 : 1;
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = std::max(0, std::atoi(argv[++i]));
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (exportPath || oneCycle || goldenPath || pipelined || ringName)
+        headless = true;
+#ifdef _WIN32
+    if (ringName)
+    {
+        std::cerr << "--shm-ring needs POSIX shared memory, which this build does not have" << std::endl;
+        return 1;
+    }
+#endif
+    if (pipelined && (oneCycle || goldenPath))
+    {
+        std::cerr << "--pipelined skips the states the renderer cannot keep up with and cannot be combined with --cycle or --golden"
+                  << std::endl;
+        return 1;
+    }
+    if (pipelined && frames <= 0)
+    {
+        std::cerr << "--pipelined needs --frames N above 0: a headless run has no ESC to stop it" << std::endl;
+        return 1;
+    }
+    if (pipelined && !exportPath)
+        std::cerr << "--pipelined without --export only measures the hand-off: finished frames are dropped" << std::endl;
+    if (ringName && pipelined)
+    {
+        std::cerr << "--shm-ring publishes from the headless render loop and cannot be combined with --pipelined" << std::endl;
+        return 1;
+    }
+
+    // --grammar replaces the children of the species, keeping its depth and colouring
+    if (customRules)
+    {
+        std::vector<TreeGrammar::Child> children(grammar.children, grammar.children + grammar.childCount);
+        grammar = *species;
+        grammar.name = "custom";
+        grammar.childCount = static_cast<int>(children.size());
+        std::copy(children.begin(), children.end(), grammar.children);
+        species = &grammar;
+    }
+    if (treeDepth == 0)
+        treeDepth = species->depth;
+    if (species->segmentCount(treeDepth) > TreeGrammar::MAX_SEGMENTS)
+    {
+        std::cerr << "A " << species->name << " " << treeDepth << " levels deep has over " << TreeGrammar::MAX_SEGMENTS << " segments" << std::endl;
+        return 1;
+    }
+
+#ifndef TREE_PROFILE
+    if (profilePath)
+    {
+        std::cerr << "--profile-out needs a build with instrumentation (make PROFILE=1)" << std::endl;
+        return 1;
+    }
+#endif
+
+    if (headless)
+    {
+        std::unique_ptr<FramebufferBackend> framebuffer;
+        if (threads > 0)
+            framebuffer = std::make_unique<TiledBackend>(threads);
+        else
+            framebuffer = std::make_unique<FramebufferBackend>();
+
+        // The recorder sits in front of the counters, so they count what the replay issues
+        RenderBackend *backend = framebuffer.get();
+#ifdef TREE_PROFILE
+        CountingBackend counting(*backend);
+        backend = &counting;
+#endif
+        std::unique_ptr<RecordingBackend> recording;
+        if (record)
+        {
+            recording = std::make_unique<RecordingBackend>(*backend);
+            backend = recording.get();
+        }
+        AnimatedTreeDrawer drawer(*backend);
+        drawer.setBranchCache(branchCache);
+        drawer.setSmoothBranches(smoothBranches);
+        drawer.setLayers(layers);
+        drawer.setIncrementalGrowth(incrementalGrowth);
+        drawer.setSprites(sprites);
+        drawer.setLeafSeed(leafSeed);
+        drawer.setGrammar(*species, treeDepth);
+        drawer.setWind(windStrength);
+        drawer.setSky(suns, clouds, cloudDrift);
+        drawer.setSeedsPerFlower(seedsPerFlower);
+        drawer.setForest(forestTrees);
+        if (goldenPath)
+        {
+            bool ok = checkGolden(drawer, *framebuffer, goldenPath, updateGolden);
+            return writeProfile(profilePath) && ok ? 0 : 1;
+        }
+        drawer.setRenderRate(renderRate);
+        drawer.setFixedClock(fixedClock);
+        drawer.setFrameBudget(std::max(0.0, frameBudget));
+        drawer.fastForward(fastForwardSeconds);
+
+        std::unique_ptr<FrameWriter> writer;
+        FILE *exportFile = nullptr;
+        if (exportPath)
+        {
+            size_t length = std::strlen(exportPath);
+            bool ppm = exportFormat ? std::strcmp(exportFormat, "ppm") == 0
+                                    : length > 4 && std::strcmp(exportPath + length - 4, ".ppm") == 0;
+            if (std::strcmp(exportPath, "-") == 0)
+            {
+#ifdef _WIN32
+                _setmode(_fileno(stdout), _O_BINARY);
+#endif
+                exportFile = stdout;
+            }
+            else if (!(exportFile = std::fopen(exportPath, "wb")))
+            {
+                std::cerr << "Could not open " << exportPath << std::endl;
+                return 1;
+            }
+            writer = std::make_unique<FrameWriter>(exportFile, ppm ? FrameWriter::PPM : FrameWriter::Y4M,
+                                                   drawer.getScreenWidth(), drawer.getScreenHeight(),
+                                                   renderRate > 0 ? renderRate : 30);
+        }
+
+#ifndef _WIN32
+        std::unique_ptr<SharedFrameRing> ring;
+        if (ringName)
+        {
+            ring = std::make_unique<SharedFrameRing>();
+            if (!ring->open(ringName, drawer.getScreenWidth(), drawer.getScreenHeight(), ringSlots,
+                            ringBlocks ? SharedRing::BLOCK : SharedRing::DROP_OLDEST, ringReplace))
+            {
+                if (errno == EEXIST)
+                    std::cerr << "Shared-memory ring " << ringName << " already exists; if no renderer is using it, "
+                              << "remove it with --shm-replace" << std::endl;
+                else
+                    std::cerr << "Could not create shared-memory ring " << ringName << ": " << std::strerror(errno) << std::endl;
+                return 1;
+            }
+        }
+#endif
+
+        std::function<void()> frameDone;
+        if (writer || ringName)
+        {
+            frameDone = [&] {
+                if (writer)
+                    writer->submit(framebuffer->data());
+#ifndef _WIN32
+                if (ring)
+                    ring->publish(framebuffer->data(), drawer.getPhase());
+#endif
+            };
+        }
+        if (pipelined)
+            drawer.runPipelined(*framebuffer, frames, [&](const Color *pixels) {
+                if (writer)
+                    writer->submit(pixels);
+            });
+        else
+            drawer.runHeadless(frames, oneCycle, frameDone);
+        drawer.reportQuality();
+
+#ifndef _WIN32
+        if (ring)
+        {
+            std::cerr << "shared-memory ring " << ringName << ": " << ring->getPublished() << " frames published, "
+                      << ring->getOverwritten() << " overwritten unread, waited for the consumer " << ring->getStalls() << " times"
+                      << std::endl;
+            ring->close();
+        }
+#endif
+
+        if (writer)
+        {
+            bool ok = writer->finish();
+            std::cerr << "exported " << writer->getFramesWritten() << " frames, render loop waited on the writer "
+                      << writer->getProducerStalls() << " times" << std::endl;
+            if (exportFile != stdout)
+                ok = std::fclose(exportFile) == 0 && ok;
+            if (!ok)
+            {
+                std::cerr << "Error writing " << exportPath << std::endl;
+                return 1;
+            }
+        }
+        if (threads > 0)
+        {
+            const TiledBackend &tiled = static_cast<const TiledBackend &>(*framebuffer);
+            std::cerr << "tiled rasterizer: " << tiled.getThreadCount() << " threads, "
+                      << tiled.getStolenTiles() << " tiles stolen" << std::endl;
+        }
+        if (recording && recording->getFrames() > 0)
+        {
+            long long recorded = recording->getFrames();
+            std::cerr << "command buffer: " << recording->getRecordedCommands() / recorded << " commands per frame in "
+                      << recording->getBatches() / recorded << " state batches; state changes per frame "
+                      << recording->getSceneStateChanges() / recorded << " as drawn, "
+                      << recording->getReplayStateChanges() / recorded << " replayed" << std::endl;
+            if (replays > 0 && !benchmarkReplay(*recording, *framebuffer, replays))
+                return 1;
+        }
+        if (snapshotPath && !framebuffer->writePPM(snapshotPath))
+        {
+            std::cerr << "Could not write " << snapshotPath << std::endl;
+            return 1;
+        }
+        return writeProfile(profilePath) ? 0 : 1;
+    }
+
+#ifndef HEADLESS
+    BgiBackend window;
+    RenderBackend *backend = &window;
+#ifdef TREE_PROFILE
+    CountingBackend counting(*backend);
+    backend = &counting;
+#endif
+    std::unique_ptr<RecordingBackend> recording;
+    if (record)
+    {
+        recording = std::make_unique<RecordingBackend>(*backend);
+        backend = recording.get();
+    }
+    AnimatedTreeDrawer drawer(*backend);
+    drawer.setBranchCache(branchCache);
+    drawer.setSmoothBranches(smoothBranches);
+    drawer.setIncrementalGrowth(incrementalGrowth);
+    drawer.setSprites(sprites);
+    drawer.setLeafSeed(leafSeed);
+    drawer.setGrammar(*species, treeDepth);
+    drawer.setWind(windStrength);
+    drawer.setSky(suns, clouds, cloudDrift);
+    drawer.setSeedsPerFlower(seedsPerFlower);
+    drawer.setForest(forestTrees);
+    drawer.setRenderRate(renderRate);
+    drawer.setFixedClock(fixedClock);
+    drawer.setFrameBudget(frameBudget >= 0 ? frameBudget : renderRate > 0 ? 1000.0 / renderRate : 0.0);
+    drawer.fastForward(fastForwardSeconds);
     drawer.run();
+    drawer.reportQuality();
+    if (!writeProfile(profilePath))
+        return 1;
+#endif
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,361 @@
+#pragma once
+
+// Optional per-frame instrumentation, compiled in with -DTREE_PROFILE
+// (make PROFILE=1). Without it the PROFILE_* macros expand to nothing and
+// none of the classes below are referenced from the hot path.
+
+#ifdef TREE_PROFILE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "render_backend.h"
+#include "tree_state.h"
+
+enum class ProfileCounter
+{
+    LINE,
+    FILL_ELLIPSE,
+    FILL_POLY,
+    BAR,
+    CLEAR,
+    TEXT,
+    STAMPS,
+    LINES,
+    SET_COLOR,
+    SET_FILL_STYLE,
+    SET_LINE_STYLE,
+    COUNT
+};
+
+enum class ProfileZone
+{
+    UPDATE,
+    DRAW_SUN,
+    DRAW_CLOUDS,
+    DRAW_SOIL,
+    DRAW_BRANCH,
+    DRAW_FLOWER,
+    SWAY,
+    DISPLAY_PHASE_INFO,
+    COUNT
+};
+
+// Log-linear histogram of durations in nanoseconds: exact below 16 ns, then
+// 16 sub-buckets per power of two (about 6% resolution) up to ~2^63 ns.
+class DurationHistogram
+{
+private:
+    static const int SUB_BUCKETS = 16;
+    static const int BUCKETS = 61 * SUB_BUCKETS;
+    long long buckets[BUCKETS] = {};
+    long long samples = 0;
+    long long maxValue = 0;
+
+    static int indexOf(long long ns)
+    {
+        if (ns < SUB_BUCKETS)
+            return static_cast<int>(std::max(0LL, ns));
+        int exponent = 63 - __builtin_clzll(static_cast<unsigned long long>(ns));
+        int sub = static_cast<int>((ns >> (exponent - 4)) & (SUB_BUCKETS - 1));
+        return std::min(BUCKETS - 1, (exponent - 3) * SUB_BUCKETS + sub);
+    }
+
+    // Upper edge of a bucket, so percentiles never under-report
+    static long long upperBound(int index)
+    {
+        if (index < SUB_BUCKETS)
+            return index;
+        int exponent = index / SUB_BUCKETS + 3;
+        long long sub = index % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (exponent - 4)) - 1;
+    }
+
+public:
+    void record(long long ns)
+    {
+        buckets[indexOf(ns)]++;
+        samples++;
+        maxValue = std::max(maxValue, ns);
+    }
+
+    long long count() const { return samples; }
+    long long max() const { return maxValue; }
+
+    long long percentile(double p) const
+    {
+        if (samples == 0)
+            return 0;
+        long long rank = static_cast<long long>(p / 100.0 * (samples - 1)) + 1;
+        long long seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += buckets[i];
+            if (seen >= rank)
+                return std::min(upperBound(i), maxValue);
+        }
+        return maxValue;
+    }
+};
+
+// Every call to the global operator new in the program. The replacement
+// operators below make this header single-translation-unit, like the rest
+// of the profiler (only main.cpp includes it).
+inline std::atomic<long long> heapAllocations{0};
+
+// All out of line, so GCC does not see malloc paired with operator delete
+__attribute__((noinline)) void *operator new(std::size_t size)
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void *p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+class Profiler
+{
+public:
+    static const int PHASES = PHASE_COUNT;
+
+private:
+    long long counters[static_cast<int>(ProfileCounter::COUNT)] = {};
+    long long zoneNanos[static_cast<int>(ProfileZone::COUNT)] = {};
+    long long zoneCalls[static_cast<int>(ProfileZone::COUNT)] = {};
+    DurationHistogram frameTimes[PHASES];
+    long long frames = 0;
+    // Heap allocations between the end of one frame and the end of the next
+    long long frameAllocations[PHASES] = {};
+    long long allocatingFrames[PHASES] = {};
+    long long lastAllocationCount = 0;
+    long long lastAllocatingFrame = 0;
+
+    static const char *counterName(int i)
+    {
+        static const char *names[] = {"line", "fillellipse", "fillpoly", "bar", "cleardevice", "outtextxy", "stamps",
+                                      "lines", "setcolor", "setfillstyle", "setlinestyle"};
+        return names[i];
+    }
+
+    static const char *zoneName(int i)
+    {
+        static const char *names[] = {"update", "drawSun", "drawClouds", "drawSoil", "drawBranch", "drawFlower",
+                                      "sway", "displayPhaseInfo"};
+        return names[i];
+    }
+
+public:
+    static Profiler &instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    void count(ProfileCounter counter) { counters[static_cast<int>(counter)]++; }
+
+    void addZone(ProfileZone zone, long long ns)
+    {
+        zoneNanos[static_cast<int>(zone)] += ns;
+        zoneCalls[static_cast<int>(zone)]++;
+    }
+
+    void recordFrame(int phase, long long ns)
+    {
+        int p = std::max(0, std::min(PHASES - 1, phase));
+        frameTimes[p].record(ns);
+        frames++;
+
+        long long allocations = heapAllocations.load(std::memory_order_relaxed);
+        if (allocations != lastAllocationCount)
+        {
+            frameAllocations[p] += allocations - lastAllocationCount;
+            allocatingFrames[p]++;
+            lastAllocatingFrame = frames;
+            lastAllocationCount = allocations;
+        }
+    }
+
+    // Start counting allocations from here, e.g. after setup
+    void markAllocations() { lastAllocationCount = heapAllocations.load(std::memory_order_relaxed); }
+    long long getFrames() const { return frames; }
+    long long getLastAllocatingFrame() const { return lastAllocatingFrame; }
+
+    // JSON when the name ends in .json, CSV (metric,key,value rows) otherwise
+    bool write(const char *path) const
+    {
+        FILE *out = std::strcmp(path, "-") == 0 ? stderr : std::fopen(path, "w");
+        if (!out)
+            return false;
+        size_t length = std::strlen(path);
+        bool json = length > 5 && std::strcmp(path + length - 5, ".json") == 0;
+        const int counterCount = static_cast<int>(ProfileCounter::COUNT);
+        const int zoneCount = static_cast<int>(ProfileZone::COUNT);
+
+        if (json)
+        {
+            std::fprintf(out, "{\n  \"frames\": %lld,\n  \"phases\": [\n", frames);
+            for (int p = 0; p < PHASES; p++)
+            {
+                const DurationHistogram &h = frameTimes[p];
+                std::fprintf(out, "    {\"phase\": %d, \"name\": \"%s\", \"frames\": %lld, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f, "
+                                  "\"allocations\": %lld, \"allocating_frames\": %lld}%s\n",
+                             p, phaseName(p), h.count(), h.percentile(50) / 1e6, h.percentile(95) / 1e6, h.percentile(99) / 1e6,
+                             h.max() / 1e6, frameAllocations[p], allocatingFrames[p], p + 1 < PHASES ? "," : "");
+            }
+            std::fprintf(out, "  ],\n  \"zones\": {\n");
+            for (int z = 0; z < zoneCount; z++)
+                std::fprintf(out, "    \"%s\": {\"calls\": %lld, \"total_ms\": %.4f}%s\n", zoneName(z), zoneCalls[z],
+                             zoneNanos[z] / 1e6, z + 1 < zoneCount ? "," : "");
+            std::fprintf(out, "  },\n  \"counters\": {\n");
+            for (int c = 0; c < counterCount; c++)
+                std::fprintf(out, "    \"%s\": %lld%s\n", counterName(c), counters[c], c + 1 < counterCount ? "," : "");
+            std::fprintf(out, "  }\n}\n");
+        }
+        else
+        {
+            std::fprintf(out, "metric,key,value\nframes,all,%lld\n", frames);
+            for (int p = 0; p < PHASES; p++)
+            {
+                const DurationHistogram &h = frameTimes[p];
+                std::fprintf(out, "frames,%s,%lld\n", phaseName(p), h.count());
+                std::fprintf(out, "frame_p50_ms,%s,%.4f\n", phaseName(p), h.percentile(50) / 1e6);
+                std::fprintf(out, "frame_p95_ms,%s,%.4f\n", phaseName(p), h.percentile(95) / 1e6);
+                std::fprintf(out, "frame_p99_ms,%s,%.4f\n", phaseName(p), h.percentile(99) / 1e6);
+                std::fprintf(out, "frame_max_ms,%s,%.4f\n", phaseName(p), h.max() / 1e6);
+                std::fprintf(out, "allocations,%s,%lld\n", phaseName(p), frameAllocations[p]);
+                std::fprintf(out, "allocating_frames,%s,%lld\n", phaseName(p), allocatingFrames[p]);
+            }
+            for (int z = 0; z < zoneCount; z++)
+            {
+                std::fprintf(out, "zone_calls,%s,%lld\n", zoneName(z), zoneCalls[z]);
+                std::fprintf(out, "zone_total_ms,%s,%.4f\n", zoneName(z), zoneNanos[z] / 1e6);
+            }
+            for (int c = 0; c < counterCount; c++)
+                std::fprintf(out, "calls,%s,%lld\n", counterName(c), counters[c]);
+        }
+
+        return out == stderr || std::fclose(out) == 0;
+    }
+};
+
+class ScopedZoneTimer
+{
+private:
+    ProfileZone zone;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit ScopedZoneTimer(ProfileZone z) : zone(z), start(std::chrono::steady_clock::now()) {}
+    ~ScopedZoneTimer()
+    {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        Profiler::instance().addZone(zone, ns);
+    }
+};
+
+// Forwards to another backend, counting primitives and state changes
+class CountingBackend : public RenderBackend
+{
+private:
+    RenderBackend &target;
+
+    static void count(ProfileCounter counter) { Profiler::instance().count(counter); }
+
+public:
+    explicit CountingBackend(RenderBackend &backend) : target(backend) {}
+
+    void initialize(int width, int height, const char *title) override { target.initialize(width, height, title); }
+    void shutdown() override { target.shutdown(); }
+    void beginFrame() override { target.beginFrame(); }
+    void endFrame() override { target.endFrame(); }
+
+    void setColor(Color color) override
+    {
+        count(ProfileCounter::SET_COLOR);
+        target.setColor(color);
+    }
+    Color getColor() const override { return target.getColor(); }
+    void setFillColor(Color color) override
+    {
+        count(ProfileCounter::SET_FILL_STYLE);
+        target.setFillColor(color);
+    }
+    void setLineThickness(int thickness) override
+    {
+        count(ProfileCounter::SET_LINE_STYLE);
+        target.setLineThickness(thickness);
+    }
+    void setBackground(Color color) override { target.setBackground(color); }
+    void setTextSize(int size) override { target.setTextSize(size); }
+
+    void clear() override
+    {
+        count(ProfileCounter::CLEAR);
+        target.clear();
+    }
+    void line(int x1, int y1, int x2, int y2) override
+    {
+        count(ProfileCounter::LINE);
+        target.line(x1, y1, x2, y2);
+    }
+    void fillEllipse(int x, int y, int rx, int ry) override
+    {
+        count(ProfileCounter::FILL_ELLIPSE);
+        target.fillEllipse(x, y, rx, ry);
+    }
+    void fillPoly(int numPoints, const int *points) override
+    {
+        count(ProfileCounter::FILL_POLY);
+        target.fillPoly(numPoints, points);
+    }
+    void bar(int left, int top, int right, int bottom) override
+    {
+        count(ProfileCounter::BAR);
+        target.bar(left, top, right, bottom);
+    }
+    void text(int x, int y, const char *str) override
+    {
+        count(ProfileCounter::TEXT);
+        target.text(x, y, str);
+    }
+    bool fastStamps() const override { return target.fastStamps(); }
+    void stamps(const Stamp &stamp, int n, const int *positions) override
+    {
+        count(ProfileCounter::STAMPS);
+        target.stamps(stamp, n, positions);
+    }
+
+    void lines(const LineSegment *segments, int n, bool antialias) override
+    {
+        count(ProfileCounter::LINES);
+        target.lines(segments, n, antialias);
+    }
+
+    bool supportsLayers() const override { return target.supportsLayers(); }
+    bool layerCurrent(int id, unsigned long long key) const override { return target.layerCurrent(id, key); }
+    void beginLayer(int id, unsigned long long key) override { target.beginLayer(id, key); }
+    void endLayer() override { target.endLayer(); }
+    void drawLayer(int id, LayerArea area) override { target.drawLayer(id, area); }
+    void clearArea(LayerArea area) override { target.clearArea(area); }
+
+    int pollKey() override { return target.pollKey(); }
+    void delay(int ms) override { target.delay(ms); }
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(zone) ScopedZoneTimer PROFILE_CONCAT(profileScope, __LINE__)(ProfileZone::zone)
+#define PROFILE_FRAME(phase, ns) Profiler::instance().recordFrame(phase, ns)
+
+#else
+
+#define PROFILE_SCOPE(zone) ((void)0)
+#define PROFILE_FRAME(phase, ns) ((void)0)
+
+#endif
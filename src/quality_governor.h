@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+// Keeps frame times inside a budget by trading away detail. Each frame's
+// render time goes into frameDone(); the governor tracks a moving average
+// and steps down one quality level when the average stays above
+// DEGRADE_AT of the budget, and back up one level when it stays below
+// RESTORE_AT. The gap between the two thresholds, the longer run needed to
+// restore than to degrade, and the settling time after each change are the
+// hysteresis that keeps the level from flickering. Every change is logged.
+class QualityGovernor
+{
+public:
+    struct Quality
+    {
+        int depthCut;     // levels taken off the tree (0 is the full tree)
+        int leavesPerTip; // most leaves drawn at a branch end (3 is all of them)
+        bool flowerPetals; // five petals and a centre, or one disc and a centre
+        int cloudCircles; // circles per cloud (5 is all of them)
+    };
+
+    struct Decision
+    {
+        long long frame;
+        int from, to;
+        double averageMs;
+    };
+
+    static const int LEVELS = 5;
+    static constexpr double DEGRADE_AT = 0.9;
+    static constexpr double RESTORE_AT = 0.5;
+    static const int DEGRADE_FRAMES = 5;  // frames in a row over DEGRADE_AT before stepping down
+    static const int RESTORE_FRAMES = 60; // frames in a row under RESTORE_AT before stepping up
+    static const int SETTLE_FRAMES = 30;  // frames after a change before the next can be considered
+
+private:
+    double budgetMs;
+    int level = 0;
+    double averageMs = 0.0; // exponential moving average, about the last ten frames
+    int overFrames = 0, underFrames = 0;
+    long long frames = 0, lastChange = 0;
+    long long framesAtLevel[LEVELS] = {};
+    std::vector<Decision> decisions;
+
+    static const Quality &levelQuality(int index)
+    {
+        static const Quality levels[LEVELS] = {
+            {0, 3, true, 5},
+            {0, 2, true, 5},
+            {1, 2, false, 4},
+            {2, 1, false, 3},
+            {3, 1, false, 2},
+        };
+        return levels[index];
+    }
+
+    void change(int to)
+    {
+        decisions.push_back({frames, level, to, averageMs});
+        level = to;
+        lastChange = frames;
+        overFrames = underFrames = 0;
+    }
+
+public:
+    // A budget of 0 turns the governor off: quality stays at level 0
+    explicit QualityGovernor(double budget = 0.0) : budgetMs(budget) {}
+
+    void setBudget(double budget) { budgetMs = budget; }
+    double getBudget() const { return budgetMs; }
+    bool isEnabled() const { return budgetMs > 0; }
+
+    int getLevel() const { return level; }
+    const Quality &quality() const { return levelQuality(level); }
+    const std::vector<Decision> &getDecisions() const { return decisions; }
+
+    // Report how long the frame just drawn took; returns whether the level changed
+    bool frameDone(double ms)
+    {
+        framesAtLevel[level]++;
+        frames++;
+        if (!isEnabled())
+            return false;
+
+        averageMs = frames == 1 ? ms : averageMs + (ms - averageMs) * 0.1;
+        if (frames - lastChange < SETTLE_FRAMES)
+            return false;
+
+        overFrames = averageMs > budgetMs * DEGRADE_AT ? overFrames + 1 : 0;
+        underFrames = averageMs < budgetMs * RESTORE_AT ? underFrames + 1 : 0;
+        if (overFrames >= DEGRADE_FRAMES && level < LEVELS - 1)
+            change(level + 1);
+        else if (underFrames >= RESTORE_FRAMES && level > 0)
+            change(level - 1);
+        else
+            return false;
+        return true;
+    }
+
+    // The decisions, one per line, then the share of frames at each level
+    void writeLog(FILE *out) const
+    {
+        for (const Decision &d : decisions)
+        {
+            std::fprintf(out, "quality: frame %lld: level %d -> %d (average %.2f ms, budget %.2f ms)\n", d.frame, d.from, d.to, d.averageMs,
+                         budgetMs);
+        }
+        std::fprintf(out, "quality: %zu changes; frames per level:", decisions.size());
+        for (int i = 0; i < LEVELS; i++)
+            std::fprintf(out, " %lld", framesAtLevel[i]);
+        std::fprintf(out, "\n");
+    }
+};
@@ -0,0 +1,525 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "font8x8.h"
+#include "render_backend.h"
+#include "span_fill.h"
+
+// Half-open pixel rectangle [left, right) x [top, bottom)
+struct ClipRect
+{
+    int left, top, right, bottom;
+};
+
+// Scanline rasterizer for the BGI primitives, writing straight into a 32-bit
+// pixel buffer. Every primitive is reduced to horizontal spans computed
+// independently of the clip rectangle, so drawing the same primitive through
+// different clip rectangles touches exactly the same pixels.
+class Rasterizer
+{
+private:
+    Color *pixels = nullptr;
+    int stride = 0;
+    ClipRect clip = {0, 0, 0, 0};
+    std::vector<double> crossings; // reused by fillPoly
+    SpanFillFn spanFill = spanFillFunction(bestSpanFill());
+
+    // Convex polygons cross every row at most twice (edges are half-open in y),
+    // so their spans need no crossing list or sort. Turning the same way at
+    // every vertex is not enough on its own (a pentagram does), so the outline
+    // must also change vertical direction only twice.
+    static bool isConvex(int numPoints, const int *points)
+    {
+        int turn = 0;
+        int firstDirection = 0, lastDirection = 0, directionChanges = 0;
+        for (int i = 0; i < numPoints; i++)
+        {
+            const int *a = points + i * 2;
+            const int *b = points + ((i + 1) % numPoints) * 2;
+            const int *c = points + ((i + 2) % numPoints) * 2;
+            long long cross = static_cast<long long>(b[0] - a[0]) * (c[1] - b[1]) - static_cast<long long>(b[1] - a[1]) * (c[0] - b[0]);
+            if (cross != 0)
+            {
+                int sign = cross > 0 ? 1 : -1;
+                if (turn != 0 && sign != turn)
+                    return false;
+                turn = sign;
+            }
+
+            int direction = (b[1] > a[1]) - (b[1] < a[1]);
+            if (direction == 0)
+                continue;
+            if (firstDirection == 0)
+                firstDirection = direction;
+            else if (direction != lastDirection)
+                directionChanges++;
+            lastDirection = direction;
+        }
+        if (firstDirection != lastDirection)
+            directionChanges++;
+        return directionChanges <= 2;
+    }
+
+    // Rows of a capsule of radius r around the segment (x1, y1)-(x2, y2):
+    // span() gives the extent of row y, if it crosses it
+    struct Capsule
+    {
+        int x1, y1, x2, y2;
+        double r, dx, dy, lengthSq, halfWidth;
+
+        Capsule(int ax, int ay, int bx, int by, double radius)
+            : x1(ax), y1(ay), x2(bx), y2(by), r(radius), dx(bx - ax), dy(by - ay)
+        {
+            lengthSq = dx * dx + dy * dy;
+            halfWidth = r * std::sqrt(lengthSq);
+        }
+
+        bool span(int y, double &lo, double &hi) const
+        {
+            lo = 1e30;
+            hi = -1e30;
+
+            // Round caps
+            double capY1 = y - y1, capY2 = y - y2;
+            if (capY1 * capY1 <= r * r)
+            {
+                double w = std::sqrt(r * r - capY1 * capY1);
+                lo = std::min(lo, x1 - w);
+                hi = std::max(hi, x1 + w);
+            }
+            if (capY2 * capY2 <= r * r)
+            {
+                double w = std::sqrt(r * r - capY2 * capY2);
+                lo = std::min(lo, x2 - w);
+                hi = std::max(hi, x2 + w);
+            }
+
+            // Body: 0 <= (p - a).d <= |d|^2 and |d x (p - a)| <= r |d|, both linear in x
+            if (lengthSq > 0)
+            {
+                double py = y - y1;
+                double bodyLo = -1e30, bodyHi = 1e30;
+                auto clampLinear = [&](double coeff, double offset, double minValue, double maxValue) {
+                    if (coeff == 0)
+                    {
+                        if (offset < minValue || offset > maxValue)
+                            bodyLo = 1e30;
+                        return;
+                    }
+                    double a = (minValue - offset) / coeff, b = (maxValue - offset) / coeff;
+                    if (a > b)
+                        std::swap(a, b);
+                    bodyLo = std::max(bodyLo, a);
+                    bodyHi = std::min(bodyHi, b);
+                };
+                clampLinear(dx, py * dy, 0, lengthSq);
+                clampLinear(-dy, dx * py, -halfWidth, halfWidth);
+                if (bodyLo <= bodyHi)
+                {
+                    lo = std::min(lo, x1 + bodyLo);
+                    hi = std::max(hi, x1 + bodyHi);
+                }
+            }
+            return lo <= hi;
+        }
+    };
+
+    // src over dst with coverage out of 256. Transparent pixels (an empty
+    // layer) have nothing to blend with and layers composite by alpha alone,
+    // so there the pixel is either taken or left, at half coverage.
+    static Color blend(Color dst, Color src, int coverage)
+    {
+        if (!(dst >> 24))
+            return coverage >= 128 ? src : dst;
+        unsigned int a = static_cast<unsigned int>(coverage), b = 256 - a;
+        Color redBlue = (((src & 0xFF00FFu) * a + (dst & 0xFF00FFu) * b) >> 8) & 0xFF00FFu;
+        Color green = (((src & 0x00FF00u) * a + (dst & 0x00FF00u) * b) >> 8) & 0x00FF00u;
+        return 0xFF000000u | redBlue | green;
+    }
+
+public:
+    // Room for the crossings of any polygon the scene draws, so worker
+    // rasterizers don't allocate the first time a big polygon lands on them
+    Rasterizer() { crossings.reserve(32); }
+
+    // Conservative bounds of each primitive as half-open rectangles
+    static ClipRect lineBounds(int x1, int y1, int x2, int y2, int thickness)
+    {
+        int reach = thickness <= 1 ? 0 : thickness / 2 + 1;
+        return {std::min(x1, x2) - reach, std::min(y1, y2) - reach, std::max(x1, x2) + reach + 1, std::max(y1, y2) + reach + 1};
+    }
+
+    // smoothLine() reaches half a pixel further, and at least one pixel
+    static ClipRect smoothLineBounds(int x1, int y1, int x2, int y2, int thickness)
+    {
+        return lineBounds(x1, y1, x2, y2, std::max(thickness, 1) + 1);
+    }
+
+    static ClipRect ellipseBounds(int x, int y, int rx, int ry)
+    {
+        return {x - rx, y - ry, x + rx + 1, y + ry + 1};
+    }
+
+    static ClipRect polyBounds(int numPoints, const int *points)
+    {
+        ClipRect box = {points[0], points[1], points[0] + 1, points[1] + 1};
+        for (int i = 1; i < numPoints; i++)
+        {
+            box.left = std::min(box.left, points[i * 2]);
+            box.top = std::min(box.top, points[i * 2 + 1]);
+            box.right = std::max(box.right, points[i * 2] + 1);
+            box.bottom = std::max(box.bottom, points[i * 2 + 1] + 1);
+        }
+        return box;
+    }
+
+    static ClipRect barBounds(int left, int top, int right, int bottom)
+    {
+        return {std::min(left, right), std::min(top, bottom), std::max(left, right) + 1, std::max(top, bottom) + 1};
+    }
+
+    static ClipRect textBounds(int x, int y, int length, int size)
+    {
+        int scale = std::max(1, size);
+        return {x, y, x + 8 * scale * length, y + 8 * scale};
+    }
+
+    static ClipRect stampBounds(const Stamp &stamp, int count, const int *positions)
+    {
+        if (count <= 0 || stamp.spans.empty())
+            return {0, 0, 0, 0};
+        int left = positions[0], top = positions[1], right = positions[0], bottom = positions[1];
+        for (int i = 1; i < count; i++)
+        {
+            left = std::min(left, positions[i * 2]);
+            right = std::max(right, positions[i * 2]);
+            top = std::min(top, positions[i * 2 + 1]);
+            bottom = std::max(bottom, positions[i * 2 + 1]);
+        }
+        return {left + stamp.left, top + stamp.top, right + stamp.right + 1, bottom + stamp.bottom + 1};
+    }
+
+    // Rasterize draw(raster) into a w x h scratch buffer and keep what it drew
+    // as a stamp anchored at (anchorX, anchorY)
+    template <typename F>
+    static Stamp captureStamp(int w, int h, int anchorX, int anchorY, F draw)
+    {
+        std::vector<Color> scratch(static_cast<size_t>(w) * h, 0);
+        Rasterizer raster;
+        raster.setTarget(scratch.data(), w, h);
+        draw(raster);
+        return stampFromPixels(scratch.data(), w, h, anchorX, anchorY);
+    }
+
+    // The pixels of a w x h buffer with non-zero alpha, as a stamp anchored at
+    // (anchorX, anchorY)
+    static Stamp stampFromPixels(const Color *pixels, int w, int h, int anchorX, int anchorY)
+    {
+        Stamp stamp;
+        for (int y = 0; y < h; y++)
+        {
+            const Color *row = pixels + static_cast<size_t>(y) * w;
+            for (int x = 0; x < w;)
+            {
+                if (!(row[x] >> 24))
+                {
+                    x++;
+                    continue;
+                }
+                int start = x;
+                while (x + 1 < w && row[x + 1] == row[start])
+                    x++;
+                stamp.spans.push_back({y - anchorY, start - anchorX, x - anchorX, row[start]});
+                x++;
+            }
+        }
+        for (size_t i = 0; i < stamp.spans.size(); i++)
+        {
+            const StampSpan &span = stamp.spans[i];
+            stamp.left = i ? std::min(stamp.left, span.x0) : span.x0;
+            stamp.right = i ? std::max(stamp.right, span.x1) : span.x1;
+            stamp.top = i ? std::min(stamp.top, span.dy) : span.dy;
+            stamp.bottom = i ? std::max(stamp.bottom, span.dy) : span.dy;
+        }
+        return stamp;
+    }
+
+    void stamps(const Stamp &stamp, int count, const int *positions)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            int x = positions[i * 2], y = positions[i * 2 + 1];
+            if (x + stamp.right < clip.left || x + stamp.left >= clip.right || y + stamp.bottom < clip.top || y + stamp.top >= clip.bottom)
+                continue;
+            for (const StampSpan &span : stamp.spans)
+                fillSpan(y + span.dy, x + span.x0, x + span.x1, span.color);
+        }
+    }
+
+    void setTarget(Color *target, int width, int height)
+    {
+        pixels = target;
+        stride = width;
+        clip = {0, 0, width, height};
+    }
+
+    void setClip(const ClipRect &rect) { clip = rect; }
+    const ClipRect &getClip() const { return clip; }
+    void setSpanFill(SpanFillKind kind) { spanFill = spanFillFunction(kind); }
+
+    // Fill pixels x0..x1 (inclusive) of row y
+    void fillSpan(int y, int x0, int x1, Color color)
+    {
+        if (y < clip.top || y >= clip.bottom)
+            return;
+        x0 = std::max(x0, clip.left);
+        x1 = std::min(x1, clip.right - 1);
+        if (x0 > x1)
+            return;
+        spanFill(pixels + static_cast<size_t>(y) * stride + x0, x1 - x0 + 1, color);
+    }
+
+    void plot(int x, int y, Color color)
+    {
+        if (x >= clip.left && x < clip.right && y >= clip.top && y < clip.bottom)
+            pixels[static_cast<size_t>(y) * stride + x] = color;
+    }
+
+    // Rectangle with both corners inclusive, like BGI bar()
+    void bar(int left, int top, int right, int bottom, Color color)
+    {
+        if (left > right)
+            std::swap(left, right);
+        if (top > bottom)
+            std::swap(top, bottom);
+        for (int y = std::max(top, clip.top); y <= std::min(bottom, clip.bottom - 1); y++)
+            fillSpan(y, left, right, color);
+    }
+
+    // One pixel wide lines use Bresenham; wider ones are filled as capsules,
+    // which is how a round-capped GDI pen of that width looks.
+    void line(int x1, int y1, int x2, int y2, int thickness, Color color)
+    {
+        if (thickness <= 1)
+        {
+            int dx = std::abs(x2 - x1), sx = x1 < x2 ? 1 : -1;
+            int dy = -std::abs(y2 - y1), sy = y1 < y2 ? 1 : -1;
+            int err = dx + dy;
+            while (true)
+            {
+                plot(x1, y1, color);
+                if (x1 == x2 && y1 == y2)
+                    break;
+                int e2 = 2 * err;
+                if (e2 >= dy)
+                {
+                    err += dy;
+                    x1 += sx;
+                }
+                if (e2 <= dx)
+                {
+                    err += dx;
+                    y1 += sy;
+                }
+            }
+            return;
+        }
+
+        Capsule capsule(x1, y1, x2, y2, thickness * 0.5);
+        int reach = static_cast<int>(std::ceil(capsule.r));
+        int yStart = std::max(std::min(y1, y2) - reach, clip.top);
+        int yEnd = std::min(std::max(y1, y2) + reach, clip.bottom - 1);
+        for (int y = yStart; y <= yEnd; y++)
+        {
+            double lo, hi;
+            if (capsule.span(y, lo, hi))
+                fillSpan(y, static_cast<int>(std::ceil(lo)), static_cast<int>(std::floor(hi)), color);
+        }
+    }
+
+    // Anti-aliased line: the capsule widened by half a pixel, with pixels
+    // well inside filled solid and the rest blended by how far their centre
+    // is from the segment
+    void smoothLine(int x1, int y1, int x2, int y2, int thickness, Color color)
+    {
+        double r = std::max(thickness, 1) * 0.5;
+        Capsule outer(x1, y1, x2, y2, r + 0.5);
+        Capsule inner(x1, y1, x2, y2, r - 0.5);
+        double dx = outer.dx, dy = outer.dy;
+        double inverseLengthSq = outer.lengthSq > 0 ? 1.0 / outer.lengthSq : 0.0;
+        int reach = static_cast<int>(std::ceil(outer.r));
+        int yStart = std::max(std::min(y1, y2) - reach, clip.top);
+        int yEnd = std::min(std::max(y1, y2) + reach, clip.bottom - 1);
+        for (int y = yStart; y <= yEnd; y++)
+        {
+            double lo, hi;
+            if (!outer.span(y, lo, hi))
+                continue;
+            int x0 = std::max(static_cast<int>(std::ceil(lo)), clip.left);
+            int xEnd = std::min(static_cast<int>(std::floor(hi)), clip.right - 1);
+            int solidStart = xEnd + 1, solidEnd = xEnd; // none
+            double innerLo, innerHi;
+            if (inner.r > 0 && inner.span(y, innerLo, innerHi))
+            {
+                int start = std::max(static_cast<int>(std::ceil(innerLo)), x0);
+                int end = std::min(static_cast<int>(std::floor(innerHi)), xEnd);
+                if (start <= end)
+                {
+                    solidStart = start;
+                    solidEnd = end;
+                }
+            }
+            Color *row = pixels + static_cast<size_t>(y) * stride;
+            for (int x = x0; x <= xEnd; x++)
+            {
+                if (x == solidStart)
+                {
+                    spanFill(row + x, solidEnd - x + 1, color);
+                    x = solidEnd;
+                    continue;
+                }
+                double px = x - x1, py = y - y1;
+                double t = std::min(std::max((px * dx + py * dy) * inverseLengthSq, 0.0), 1.0);
+                double ex = px - t * dx, ey = py - t * dy;
+                double coverage = r + 0.5 - std::sqrt(ex * ex + ey * ey);
+                if (coverage > 0)
+                    row[x] = blend(row[x], color, static_cast<int>(std::min(coverage, 1.0) * 256));
+            }
+        }
+    }
+
+    // A list of segments, each in its own width and colour, drawn one after
+    // another by line() or smoothLine(); segments entirely outside the clip
+    // rectangle are skipped before any per-row work. Nothing else is shared
+    // between segments, as the capsule rows cost far more than the setup.
+    void lines(const LineSegment *segments, int count, bool antialias)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            const LineSegment &s = segments[i];
+            ClipRect box = antialias ? smoothLineBounds(s.x1, s.y1, s.x2, s.y2, s.thickness) : lineBounds(s.x1, s.y1, s.x2, s.y2, s.thickness);
+            if (box.right <= clip.left || box.left >= clip.right || box.bottom <= clip.top || box.top >= clip.bottom)
+                continue;
+            if (antialias)
+                smoothLine(s.x1, s.y1, s.x2, s.y2, s.thickness, s.color);
+            else
+                line(s.x1, s.y1, s.x2, s.y2, s.thickness, s.color);
+        }
+    }
+
+    void fillEllipse(int x, int y, int rx, int ry, Color color)
+    {
+        if (rx < 0 || ry < 0)
+            return;
+        if (ry == 0)
+        {
+            fillSpan(y, x - rx, x + rx, color);
+            return;
+        }
+        int yStart = std::max(y - ry, clip.top);
+        int yEnd = std::min(y + ry, clip.bottom - 1);
+        for (int row = yStart; row <= yEnd; row++)
+        {
+            double t = static_cast<double>(row - y) / ry;
+            int halfWidth = static_cast<int>(rx * std::sqrt(std::max(0.0, 1.0 - t * t)) + 0.5);
+            fillSpan(row, x - halfWidth, x + halfWidth, color);
+        }
+    }
+
+    // Even-odd scanline fill sampled at integer rows, then the outline, as BGI fillpoly does
+    void fillPoly(int numPoints, const int *points, Color fill, Color outline)
+    {
+        if (numPoints < 2)
+            return;
+
+        int minY = points[1], maxY = points[1];
+        for (int i = 1; i < numPoints; i++)
+        {
+            minY = std::min(minY, points[i * 2 + 1]);
+            maxY = std::max(maxY, points[i * 2 + 1]);
+        }
+
+        bool convex = isConvex(numPoints, points);
+        for (int y = std::max(minY, clip.top); y <= std::min(maxY, clip.bottom - 1); y++)
+        {
+            if (convex)
+            {
+                double lo = 1e30, hi = -1e30;
+                for (int i = 0; i < numPoints; i++)
+                {
+                    int j = (i + 1) % numPoints;
+                    int ax = points[i * 2], ay = points[i * 2 + 1];
+                    int bx = points[j * 2], by = points[j * 2 + 1];
+                    if (ay == by)
+                        continue;
+                    if (ay > by)
+                    {
+                        std::swap(ax, bx);
+                        std::swap(ay, by);
+                    }
+                    if (y < ay || y >= by)
+                        continue;
+                    double x = ax + static_cast<double>(y - ay) * (bx - ax) / (by - ay);
+                    lo = std::min(lo, x);
+                    hi = std::max(hi, x);
+                }
+                if (lo <= hi)
+                    fillSpan(y, static_cast<int>(std::ceil(lo)), static_cast<int>(std::floor(hi)), fill);
+                continue;
+            }
+
+            crossings.clear();
+            for (int i = 0; i < numPoints; i++)
+            {
+                int j = (i + 1) % numPoints;
+                int ax = points[i * 2], ay = points[i * 2 + 1];
+                int bx = points[j * 2], by = points[j * 2 + 1];
+                if (ay == by)
+                    continue;
+                if (ay > by)
+                {
+                    std::swap(ax, bx);
+                    std::swap(ay, by);
+                }
+                if (y < ay || y >= by)
+                    continue;
+                crossings.push_back(ax + static_cast<double>(y - ay) * (bx - ax) / (by - ay));
+            }
+            std::sort(crossings.begin(), crossings.end());
+            for (size_t k = 0; k + 1 < crossings.size(); k += 2)
+                fillSpan(y, static_cast<int>(std::ceil(crossings[k])), static_cast<int>(std::floor(crossings[k + 1])), fill);
+        }
+
+        for (int i = 0; i < numPoints; i++)
+        {
+            int j = (i + 1) % numPoints;
+            line(points[i * 2], points[i * 2 + 1], points[j * 2], points[j * 2 + 1], 1, outline);
+        }
+    }
+
+    // DEFAULT_FONT: 8x8 glyphs magnified by size
+    void text(int x, int y, const char *str, int size, Color color)
+    {
+        size = std::max(1, size);
+        for (; *str; str++, x += 8 * size)
+        {
+            unsigned char ch = static_cast<unsigned char>(*str);
+            if (ch < 0x20 || ch > 0x7E)
+                continue;
+            const unsigned char *glyph = FONT8X8[ch - 0x20];
+            for (int row = 0; row < 8; row++)
+            {
+                for (int col = 0; col < 8; col++)
+                {
+                    if (!(glyph[row] & (1 << col)))
+                        continue;
+                    for (int sy = 0; sy < size; sy++)
+                        fillSpan(y + row * size + sy, x + col * size, x + col * size + size - 1, color);
+                }
+            }
+        }
+    }
+};
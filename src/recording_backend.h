@@ -0,0 +1,111 @@
+#pragma once
+
+#include "command_buffer.h"
+#include "render_backend.h"
+
+// Backend that records each frame into a command buffer and replays it into
+// another backend at endFrame, reordered so that commands sharing colour and
+// line width run together (CommandBuffer::sortByState; the pixels come out
+// the same). The last frame stays recorded, so replay() can present it again
+// without running the scene.
+class RecordingBackend : public RenderBackend
+{
+private:
+    RenderBackend &target;
+    CommandBuffer commands;
+    bool sortCommands = true;
+    int width = 0, height = 0;
+
+    Color color = rgb(255, 255, 255);
+    Color fillColor = rgb(255, 255, 255);
+    Color background = rgb(0, 0, 0);
+    int lineThickness = 1;
+    int textSize = 1;
+
+    long long frames = 0, recordedCommands = 0, batches = 0;
+    long long sceneStateChanges = 0;  // setter calls that changed the value, as the scene made them
+    long long replayStateChanges = 0; // setter calls made into the target
+
+    template <typename T>
+    void setState(T &current, T value)
+    {
+        if (current != value)
+            sceneStateChanges++;
+        current = value;
+    }
+
+    int present(bool sorted)
+    {
+        target.beginFrame();
+        int changes = commands.replay(target, sorted);
+        target.endFrame();
+        return changes;
+    }
+
+public:
+    explicit RecordingBackend(RenderBackend &backend) : target(backend) {}
+
+    // Off replays in the order the scene drew, for comparison
+    void setSorting(bool enabled) { sortCommands = enabled; }
+
+    void initialize(int w, int h, const char *title) override
+    {
+        width = w;
+        height = h;
+        commands.reset(w, h);
+        target.initialize(w, h, title);
+    }
+    void shutdown() override { target.shutdown(); }
+
+    void beginFrame() override { commands.reset(width, height); }
+    void endFrame() override
+    {
+        if (sortCommands)
+            commands.sortByState();
+        frames++;
+        recordedCommands += commands.size();
+        batches += sortCommands ? commands.getBatchCount() : commands.size();
+        replayStateChanges += present(true);
+    }
+
+    // Present the last recorded frame again, state-sorted (if it was sorted
+    // when recorded) or in the order the scene drew it. Returns the number of
+    // state calls made.
+    int replay(bool sorted = true) { return present(sorted); }
+
+    void setColor(Color c) override { setState(color, c); }
+    Color getColor() const override { return color; }
+    void setFillColor(Color c) override { setState(fillColor, c); }
+    void setLineThickness(int thickness) override { setState(lineThickness, thickness); }
+    void setBackground(Color c) override { setState(background, c); }
+    void setTextSize(int size) override { setState(textSize, size); }
+
+    void clear() override { commands.clear(background); }
+    void line(int x1, int y1, int x2, int y2) override { commands.line(x1, y1, x2, y2, lineThickness, color); }
+    void lines(const LineSegment *segments, int count, bool antialias) override
+    {
+        if (count <= 0)
+            return;
+        commands.lines(segments, count, antialias);
+        setState(color, segments[count - 1].color);
+        setState(lineThickness, segments[count - 1].thickness);
+    }
+    void fillEllipse(int x, int y, int rx, int ry) override { commands.fillEllipse(x, y, rx, ry, fillColor); }
+    void fillPoly(int numPoints, const int *points) override { commands.fillPoly(numPoints, points, fillColor, color); }
+    void bar(int left, int top, int right, int bottom) override { commands.bar(left, top, right, bottom, fillColor); }
+    void text(int x, int y, const char *str) override { commands.text(x, y, str, textSize, color); }
+    bool fastStamps() const override { return target.fastStamps(); } // stamps are replayed into the target
+    void stamps(const Stamp &stamp, int count, const int *positions) override { commands.stamps(stamp, count, positions); }
+
+    // Recording has no pixels to cache between frames
+    bool supportsLayers() const override { return false; }
+
+    int pollKey() override { return target.pollKey(); }
+    void delay(int ms) override { target.delay(ms); }
+
+    long long getFrames() const { return frames; }
+    long long getRecordedCommands() const { return recordedCommands; }
+    long long getBatches() const { return batches; }
+    long long getSceneStateChanges() const { return sceneStateChanges; }
+    long long getReplayStateChanges() const { return replayStateChanges; }
+};
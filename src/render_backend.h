@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Packed 0xAARRGGBB colour shared by every backend
+using Color = std::uint32_t;
+
+constexpr Color rgb(int r, int g, int b)
+{
+    return 0xFF000000u | (static_cast<Color>(r) << 16) | (static_cast<Color>(g) << 8) | static_cast<Color>(b);
+}
+
+constexpr int colorRed(Color c) { return (c >> 16) & 0xFF; }
+constexpr int colorGreen(Color c) { return (c >> 8) & 0xFF; }
+constexpr int colorBlue(Color c) { return c & 0xFF; }
+
+// Part of the screen RenderBackend::drawLayer and clearArea cover
+enum class LayerArea
+{
+    FULL,           // the whole screen
+    PREVIOUS_DIRTY, // what the previous frame drew with ordinary primitives
+    CURRENT_DIRTY   // what this frame has drawn with ordinary primitives so far
+};
+
+// A small shape rasterized once and then copied many times: spans [x0, x1]
+// on row dy, relative to the point the stamp is drawn at
+struct StampSpan
+{
+    int dy, x0, x1;
+    Color color;
+};
+
+struct Stamp
+{
+    std::vector<StampSpan> spans;
+    int left = 0, top = 0, right = -1, bottom = -1; // inclusive bounds of all spans
+};
+
+// One segment of a RenderBackend::lines list, with its own width and colour
+struct LineSegment
+{
+    int x1, y1, x2, y2;
+    int thickness;
+    Color color;
+};
+
+// The subset of BGI that AnimatedTreeDrawer needs. Coordinates are integer
+// screen pixels, exactly as the original graphics.h calls took them.
+class RenderBackend
+{
+public:
+    virtual ~RenderBackend() = default;
+
+    virtual void initialize(int width, int height, const char *title) = 0;
+    virtual void shutdown() = 0;
+
+    // beginFrame selects the page to draw into, endFrame makes it visible
+    virtual void beginFrame() = 0;
+    virtual void endFrame() = 0;
+
+    // Drawing state (setcolor / setfillstyle / setlinestyle / setbkcolor / settextstyle)
+    virtual void setColor(Color color) = 0;
+    virtual Color getColor() const = 0;
+    virtual void setFillColor(Color color) = 0;
+    virtual void setLineThickness(int thickness) = 0;
+    virtual void setBackground(Color color) = 0;
+    virtual void setTextSize(int size) = 0;
+
+    // Primitives (cleardevice / line / fillellipse / fillpoly / bar / outtextxy)
+    virtual void clear() = 0;
+    virtual void line(int x1, int y1, int x2, int y2) = 0;
+    virtual void fillEllipse(int x, int y, int rx, int ry) = 0;
+    virtual void fillPoly(int numPoints, const int *points) = 0;
+    virtual void bar(int left, int top, int right, int bottom) = 0;
+    virtual void text(int x, int y, const char *str) = 0;
+
+    // Draw `stamp` at each of the `count` (x, y) pairs in positions, for
+    // thousands of identical small shapes. The default goes through bar(),
+    // so it leaves the fill colour set to the last span's colour; backends
+    // that copy the spans themselves say so in fastStamps().
+    virtual bool fastStamps() const { return false; }
+    virtual void stamps(const Stamp &stamp, int count, const int *positions)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            int x = positions[i * 2], y = positions[i * 2 + 1];
+            for (const StampSpan &span : stamp.spans)
+            {
+                setFillColor(span.color);
+                bar(x + span.x0, y + span.dy, x + span.x1, y + span.dy);
+            }
+        }
+    }
+
+    // Draw `count` segments, each in its own colour and width, for the
+    // thousands of branches of a tree. With `antialias` the edges are blended
+    // into what is underneath, where the backend can. The default goes
+    // through line(), so it leaves colour and width set to the last segment's;
+    // overrides do the same.
+    virtual void lines(const LineSegment *segments, int count, bool antialias)
+    {
+        (void)antialias;
+        for (int i = 0; i < count; i++)
+        {
+            const LineSegment &s = segments[i];
+            if (i == 0 || s.color != segments[i - 1].color)
+                setColor(s.color);
+            if (i == 0 || s.thickness != segments[i - 1].thickness)
+                setLineThickness(s.thickness);
+            line(s.x1, s.y1, s.x2, s.y2);
+        }
+    }
+
+    // Retained layers, for backends that keep pixels between frames. Drawing
+    // between beginLayer and endLayer goes into layer `id` (initially
+    // transparent) instead of the frame, and the layer remembers `key`.
+    // drawLayer and clearArea (fill with the background colour) do not count
+    // as drawing for the dirty areas. The defaults do nothing, so callers
+    // check supportsLayers() and otherwise draw everything directly.
+    virtual bool supportsLayers() const { return false; }
+    virtual bool layerCurrent(int id, unsigned long long key) const
+    {
+        (void)id;
+        (void)key;
+        return false;
+    }
+    virtual void beginLayer(int id, unsigned long long key)
+    {
+        (void)id;
+        (void)key;
+    }
+    virtual void endLayer() {}
+    virtual void drawLayer(int id, LayerArea area)
+    {
+        (void)id;
+        (void)area;
+    }
+    virtual void clearArea(LayerArea area) { (void)area; }
+
+    // Input and pacing; offscreen backends never see keys and never sleep
+    virtual int pollKey() { return -1; }
+    virtual void delay(int ms) { (void)ms; }
+};
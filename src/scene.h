@@ -0,0 +1,268 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "hash.h"
+#include "render_backend.h"
+#include "trig_tables.h"
+
+// The sky as entities with components, each component kept in its own dense
+// array so the systems below run straight through memory:
+//
+//   Transform   where the entity is on screen
+//   Orbit       a path across the sky, driven by the sun angle
+//   Particle    steady drift from where it started, wrapping around the sky
+//   Renderable  what to draw: shape, colour and size
+//
+// Update systems (updateOrbits, updateDrift) write the transforms for the
+// frame; render systems (drawSuns, drawClouds) draw every entity of a shape
+// in one pass. The life cycle's sky is lifeCycle(): one sun and three clouds
+// that stay put, which draws exactly what the animation always has. Trees
+// are not entities: the single tree follows the phase state machine, and
+// the forest keeps its many trees in rows of its own.
+
+using Entity = int;
+
+// Sparse set: the components in creation order, plus each entity's slot
+template <typename T>
+class ComponentArray
+{
+private:
+    std::vector<T> dense;
+    std::vector<Entity> owners; // entity of dense[i]
+    std::vector<int> slotOf;    // slot of each entity, -1 without one
+
+public:
+    T &add(Entity entity, const T &value)
+    {
+        if (entity >= static_cast<int>(slotOf.size()))
+            slotOf.resize(entity + 1, -1);
+        if (slotOf[entity] >= 0)
+            return dense[slotOf[entity]] = value;
+        slotOf[entity] = static_cast<int>(dense.size());
+        dense.push_back(value);
+        owners.push_back(entity);
+        return dense.back();
+    }
+
+    // Swaps the last component into the gap, so the array stays dense
+    void remove(Entity entity)
+    {
+        if (!has(entity))
+            return;
+        int slot = slotOf[entity];
+        dense[slot] = dense.back();
+        owners[slot] = owners.back();
+        slotOf[owners[slot]] = slot;
+        dense.pop_back();
+        owners.pop_back();
+        slotOf[entity] = -1;
+    }
+
+    bool has(Entity entity) const { return entity < static_cast<int>(slotOf.size()) && slotOf[entity] >= 0; }
+    T &get(Entity entity) { return dense[slotOf[entity]]; }
+    const T &get(Entity entity) const { return dense[slotOf[entity]]; }
+
+    size_t size() const { return dense.size(); }
+    T &operator[](size_t slot) { return dense[slot]; }
+    const T &operator[](size_t slot) const { return dense[slot]; }
+    Entity owner(size_t slot) const { return owners[slot]; }
+};
+
+class Scene
+{
+public:
+    struct Transform
+    {
+        float x, y;
+    };
+
+    // x = width * a / pi and y = top + height * sin(a), a being the sun
+    // angle plus `phase` (mod 2 pi): across the sky from the left edge for a
+    // up to pi, then out of sight to the right
+    struct Orbit
+    {
+        float width, height, top;
+        float phase;
+    };
+
+    struct Particle
+    {
+        float originX, originY;
+        float velocityX, velocityY; // pixels per second
+    };
+
+    enum Shape
+    {
+        SUN,
+        CLOUD
+    };
+
+    struct Renderable
+    {
+        Shape shape;
+        Color color;
+        int size; // sun radius, cloud puffs
+    };
+
+    static const int MAX_PUFFS = 5; // circles in a whole cloud
+    static const int SUN_RAYS = 12;
+
+    ComponentArray<Transform> transforms;
+    ComponentArray<Orbit> orbits;
+    ComponentArray<Particle> particles;
+    ComponentArray<Renderable> renderables;
+
+private:
+    int entityCount = 0;
+    float skyWidth = 0.0f; // drifting entities wrap around [-DRIFT_MARGIN, skyWidth + DRIFT_MARGIN)
+    static constexpr float DRIFT_MARGIN = 150.0f;
+
+    // Offsets and radius of puff i of every cloud, left to right
+    struct Puff
+    {
+        int dx, dy, radius;
+    };
+    static const Puff &puff(int i)
+    {
+        static const Puff puffs[MAX_PUFFS] = {{0, -10, 20}, {25, 3, 27}, {50, -4, 24}, {75, 9, 21}, {100, 2, 28}};
+        return puffs[i];
+    }
+
+public:
+    Entity createEntity() { return entityCount++; }
+    int getEntityCount() const { return entityCount; }
+
+    Entity addSun(const Orbit &orbit, int radius, Color color)
+    {
+        Entity sun = createEntity();
+        transforms.add(sun, {0.0f, 0.0f});
+        orbits.add(sun, orbit);
+        renderables.add(sun, {SUN, color, radius});
+        return sun;
+    }
+
+    // A cloud with `puffs` circles, drifting at velocityX if it is not 0
+    Entity addCloud(float x, float y, int puffs, Color color, float velocityX = 0.0f)
+    {
+        Entity cloud = createEntity();
+        transforms.add(cloud, {x, y});
+        if (velocityX != 0.0f)
+            particles.add(cloud, {x, y, velocityX, 0.0f});
+        renderables.add(cloud, {CLOUD, color, std::min(puffs, MAX_PUFFS)});
+        return cloud;
+    }
+
+    // The animation's sky: `suns` suns spaced evenly around the one orbit
+    // (the first is the sun the sky colour follows) and `clouds` clouds, the
+    // first three where they have always been and the rest scattered over
+    // the sky by `seed`, all drifting at `drift` pixels per second
+    static Scene lifeCycle(int width, int suns, int clouds, float drift, unsigned int seed, Color sunColor, Color cloudColor)
+    {
+        Scene scene;
+        scene.skyWidth = static_cast<float>(width);
+        for (int i = 0; i < suns; i++)
+            scene.addSun({static_cast<float>(width), 150.0f, 50.0f, static_cast<float>(i * 2 * 3.14159 / suns)}, 30, sunColor);
+        for (int i = 0; i < clouds; i++)
+        {
+            float x = i < 3 ? 100.0f + i * 200.0f : unitHash(seed, i * 2u) * width;
+            float y = i < 3 ? 80.0f + (i * 17) % 50 : 40.0f + unitHash(seed, i * 2u + 1) * 100.0f;
+            scene.addCloud(x, y, MAX_PUFFS, cloudColor, drift);
+        }
+        return scene;
+    }
+
+    // The first entity drawn as `shape`, or -1
+    Entity find(Shape shape) const
+    {
+        for (size_t i = 0; i < renderables.size(); i++)
+        {
+            if (renderables[i].shape == shape)
+                return renderables.owner(i);
+        }
+        return -1;
+    }
+
+    // Whether any entity drifts, so the sky cannot be cached
+    bool hasDrift() const { return particles.size() > 0; }
+
+    // Place every orbiting entity for this sun angle
+    void updateOrbits(double sunAngle)
+    {
+        for (size_t i = 0; i < orbits.size(); i++)
+        {
+            const Orbit &orbit = orbits[i];
+            double angle = sunAngle + orbit.phase;
+            if (angle > 2 * 3.14159)
+                angle -= 2 * 3.14159;
+            Transform &t = transforms.get(orbits.owner(i));
+            t.x = static_cast<float>(static_cast<int>(orbit.width * angle / 3.14159));
+            t.y = static_cast<float>(static_cast<int>(orbit.height * std::sin(angle)) + orbit.top);
+        }
+    }
+
+    // Move every drifting entity to where it is `seconds` in
+    void updateDrift(double seconds)
+    {
+        float span = skyWidth + 2 * DRIFT_MARGIN;
+        for (size_t i = 0; i < particles.size(); i++)
+        {
+            const Particle &p = particles[i];
+            Transform &t = transforms.get(particles.owner(i));
+            double x = p.originX + DRIFT_MARGIN + p.velocityX * seconds;
+            t.x = static_cast<float>(x - span * std::floor(x / span) - DRIFT_MARGIN);
+            t.y = static_cast<float>(p.originY + p.velocityY * seconds);
+        }
+    }
+
+    // Every sun: a disc and twelve rays, the rays in the current line width
+    void drawSuns(RenderBackend &target) const
+    {
+        for (size_t i = 0; i < renderables.size(); i++)
+        {
+            const Renderable &r = renderables[i];
+            if (r.shape != SUN)
+                continue;
+            const Transform &t = transforms.get(renderables.owner(i));
+            int x = static_cast<int>(t.x), y = static_cast<int>(t.y);
+            target.setColor(r.color);
+            target.setFillColor(r.color);
+            target.fillEllipse(x, y, r.size, r.size);
+            for (int ray = 0; ray < SUN_RAYS; ray++)
+            {
+                double c = TWELVE_POINTS.cosines[ray], s = TWELVE_POINTS.sines[ray]; // every 30 degrees
+                target.line(x + static_cast<int>((r.size + 5) * c), y + static_cast<int>((r.size + 5) * s), x + static_cast<int>((r.size + 20) * c),
+                            y + static_cast<int>((r.size + 20) * s));
+            }
+        }
+    }
+
+    // Every cloud, with at most `maxPuffs` of its circles
+    void drawClouds(RenderBackend &target, int maxPuffs) const
+    {
+        Color current = 0;
+        bool colorSet = false;
+        for (size_t i = 0; i < renderables.size(); i++)
+        {
+            const Renderable &r = renderables[i];
+            if (r.shape != CLOUD)
+                continue;
+            if (!colorSet || r.color != current)
+            {
+                target.setColor(r.color);
+                target.setFillColor(r.color);
+                current = r.color;
+                colorSet = true;
+            }
+            const Transform &t = transforms.get(renderables.owner(i));
+            int x = static_cast<int>(t.x), y = static_cast<int>(t.y);
+            for (int k = 0; k < std::min(r.size, maxPuffs); k++)
+            {
+                const Puff &p = puff(k);
+                target.fillEllipse(x + p.dx, y + p.dy, p.radius, p.radius);
+            }
+        }
+    }
+};
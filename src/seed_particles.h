@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "frame_arena.h"
+#include "hash.h"
+#include "rasterizer.h"
+#include "render_backend.h"
+#include "trig_tables.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Outline of a seed: a 12-point oval `size` pixels across its long half-axis,
+// turned by `angle` about (x, y), plus the line drawn through it lengthwise
+inline void seedShape(int x, int y, double angle, int size, int points[24], int line[4])
+{
+    const int numPoints = 12;
+    double c = cos(angle), s = sin(angle);
+    for (int i = 0; i < numPoints; i++)
+    {
+        // Oval shape (wider than tall)
+        double localX = size * TWELVE_POINTS.cosines[i];
+        double localY = size * 0.5 * TWELVE_POINTS.sines[i];
+
+        // Apply rotation transformation
+        points[i * 2] = x + static_cast<int>(localX * c - localY * s);
+        points[i * 2 + 1] = y + static_cast<int>(localX * s + localY * c);
+    }
+
+    int lineLength = static_cast<int>(size * 0.8);
+    line[0] = x + static_cast<int>(lineLength * c);
+    line[1] = y + static_cast<int>(lineLength * s);
+    line[2] = x - static_cast<int>(lineLength * c);
+    line[3] = y - static_cast<int>(lineLength * s);
+}
+
+// Seeds released by the flowers, stored structure-of-arrays so a tick is a
+// few straight passes over float arrays. Units and forces follow the single
+// falling seed of updateFallingSeeds: pixels and radians per simulation tick,
+// gravity 0.3, a rightward wind and a constant spin, here varied per seed.
+// Seeds that reach the ground are removed by moving the last seed into their
+// slot, so live seeds always fill [0, size()) in no particular order.
+class SeedParticles
+{
+public:
+    static constexpr float GRAVITY = 0.3f;
+    static constexpr float WIND = 1.5f;
+    static constexpr float TWO_PI = 6.2831853f;
+    static const int ANGLE_STEPS = 16; // rotations rasterized per stamp size
+
+    std::vector<float> x, y, vx, vy, angle, spin;
+
+private:
+    bool vectorized = true;
+    long long released = 0, landed = 0;
+    // stamps[size][step]: the seed at that size and rotation, built on first use
+    std::vector<std::vector<Stamp>> stamps;
+
+    void remove(size_t i)
+    {
+        size_t last = x.size() - 1;
+        x[i] = x[last];
+        y[i] = y[last];
+        vx[i] = vx[last];
+        vy[i] = vy[last];
+        angle[i] = angle[last];
+        spin[i] = spin[last];
+        x.pop_back();
+        y.pop_back();
+        vx.pop_back();
+        vy.pop_back();
+        angle.pop_back();
+        spin.pop_back();
+    }
+
+    // Semi-implicit Euler: velocity first, then position. Returns whether
+    // any seed ended at or below groundY.
+    bool integrate(float groundY)
+    {
+        size_t n = size();
+        float *px = x.data(), *py = y.data(), *pvx = vx.data(), *pvy = vy.data();
+        float *pa = angle.data(), *ps = spin.data();
+        size_t i = 0;
+        bool grounded = false;
+#ifdef __SSE2__
+        if (vectorized)
+        {
+            const __m128 gravity = _mm_set1_ps(GRAVITY), twoPi = _mm_set1_ps(TWO_PI);
+            const __m128 ground = _mm_set1_ps(groundY), zero = _mm_setzero_ps();
+            __m128 hits = zero;
+            for (; i + 4 <= n; i += 4)
+            {
+                __m128 velocityY = _mm_add_ps(_mm_loadu_ps(pvy + i), gravity);
+                __m128 newY = _mm_add_ps(_mm_loadu_ps(py + i), velocityY);
+                _mm_storeu_ps(pvy + i, velocityY);
+                _mm_storeu_ps(py + i, newY);
+                _mm_storeu_ps(px + i, _mm_add_ps(_mm_loadu_ps(px + i), _mm_loadu_ps(pvx + i)));
+
+                // Spins are far below a turn per tick, so one wrap keeps [0, 2pi)
+                __m128 a = _mm_add_ps(_mm_loadu_ps(pa + i), _mm_loadu_ps(ps + i));
+                a = _mm_sub_ps(a, _mm_and_ps(_mm_cmpge_ps(a, twoPi), twoPi));
+                a = _mm_add_ps(a, _mm_and_ps(_mm_cmplt_ps(a, zero), twoPi));
+                _mm_storeu_ps(pa + i, a);
+
+                hits = _mm_or_ps(hits, _mm_cmpge_ps(newY, ground));
+            }
+            grounded = _mm_movemask_ps(hits) != 0;
+        }
+#endif
+        for (; i < n; i++)
+        {
+            pvy[i] += GRAVITY;
+            py[i] += pvy[i];
+            px[i] += pvx[i];
+            float a = pa[i] + ps[i];
+            if (a >= TWO_PI)
+                a -= TWO_PI;
+            if (a < 0)
+                a += TWO_PI;
+            pa[i] = a;
+            grounded = grounded || py[i] >= groundY;
+        }
+        return grounded;
+    }
+
+    const Stamp &stampFor(int size, int step)
+    {
+        if (size >= static_cast<int>(stamps.size()))
+            stamps.resize(size + 1);
+        std::vector<Stamp> &rotations = stamps[size];
+        if (rotations.empty())
+        {
+            int extent = size * 2 + 4;
+            for (int s = 0; s < ANGLE_STEPS; s++)
+            {
+                double a = (s + 0.5) * TWO_PI / ANGLE_STEPS;
+                rotations.push_back(Rasterizer::captureStamp(extent, extent, extent / 2, extent / 2, [&](Rasterizer &raster) {
+                    int points[24], line[4];
+                    seedShape(extent / 2, extent / 2, a, size, points, line);
+                    raster.fillPoly(12, points, rgb(160, 82, 45), rgb(160, 82, 45));
+                    raster.line(line[0], line[1], line[2], line[3], std::max(1, size / 24), rgb(100, 50, 20));
+                }));
+            }
+        }
+        return rotations[step];
+    }
+
+public:
+    size_t size() const { return x.size(); }
+    long long getReleased() const { return released; }
+    long long getLanded() const { return landed; }
+
+    // Off keeps the whole tick on the scalar loop, for comparison
+    void setVectorized(bool enabled) { vectorized = enabled; }
+
+    void clear()
+    {
+        x.clear();
+        y.clear();
+        vx.clear();
+        vy.clear();
+        angle.clear();
+        spin.clear();
+    }
+
+    // Take over other's seeds (but not its counters or stamps), reusing this
+    // one's arrays
+    void copySeeds(const SeedParticles &other)
+    {
+        x = other.x;
+        y = other.y;
+        vx = other.vx;
+        vy = other.vy;
+        angle = other.angle;
+        spin = other.spin;
+    }
+
+    void reserve(size_t n)
+    {
+        x.reserve(n);
+        y.reserve(n);
+        vx.reserve(n);
+        vy.reserve(n);
+        angle.reserve(n);
+        spin.reserve(n);
+    }
+
+    // Release `count` seeds at (px, py). Their drift, launch speed, spin and
+    // starting angle are hashed from (seed, key, index), so the same call
+    // always releases the same seeds.
+    void emit(float px, float py, int count, unsigned int seed, unsigned int key)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            unsigned int base = (key * 1024u + static_cast<unsigned int>(i)) * 4u;
+            float drift = unitHash(seed, base) * 2.0f - 1.0f;
+            float direction = unitHash(seed, base + 2) < 0.5f ? -1.0f : 1.0f;
+            x.push_back(px);
+            y.push_back(py);
+            vx.push_back(WIND + drift);
+            vy.push_back(-3.0f * unitHash(seed, base + 1));
+            spin.push_back(direction * (0.1f + 0.2f * unitHash(seed, base + 3)));
+            angle.push_back(TWO_PI * unitHash(seed + 1, base));
+        }
+        released += count;
+    }
+
+    // Advance every seed one tick and drop the ones that reached groundY
+    void step(float groundY)
+    {
+        if (!integrate(groundY))
+            return;
+        for (size_t i = 0; i < size();)
+        {
+            if (y[i] >= groundY)
+            {
+                remove(i);
+                landed++;
+            }
+            else
+                i++;
+        }
+    }
+
+    // Draw every seed `alpha` of the way from the previous tick to the current
+    // one (the previous position is the current one minus one tick of
+    // velocity), `stampSize` pixels long, at screen position project(x, y).
+    // Seeds are bucketed by rotation with a counting sort in `arena` and each
+    // bucket goes to the backend as a single stamps() call.
+    template <typename Project>
+    void draw(RenderBackend &gfx, FrameArena &arena, double alpha, int stampSize, int screenWidth, int screenHeight, Project project)
+    {
+        size_t n = size();
+        if (n == 0 || stampSize < 1)
+            return;
+        float back = static_cast<float>(1.0 - alpha);
+        int reach = stampSize + 2;
+
+        int *screen = arena.allocate<int>(n * 2);
+        unsigned char *bucket = arena.allocate<unsigned char>(n);
+        int counts[ANGLE_STEPS + 1] = {};
+        size_t visible = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            int sx, sy;
+            project(x[i] - vx[i] * back, y[i] - vy[i] * back, sx, sy);
+            if (sx < -reach || sy < -reach || sx >= screenWidth + reach || sy >= screenHeight + reach)
+                continue;
+            float a = angle[i] - spin[i] * back;
+            int b = static_cast<int>(a * (ANGLE_STEPS / TWO_PI)) & (ANGLE_STEPS - 1);
+            screen[visible * 2] = sx;
+            screen[visible * 2 + 1] = sy;
+            bucket[visible] = static_cast<unsigned char>(b);
+            counts[b + 1]++;
+            visible++;
+        }
+
+        for (int b = 0; b < ANGLE_STEPS; b++)
+            counts[b + 1] += counts[b];
+        int *sorted = arena.allocate<int>(visible * 2);
+        int next[ANGLE_STEPS];
+        std::copy(counts, counts + ANGLE_STEPS, next);
+        for (size_t i = 0; i < visible; i++)
+        {
+            int slot = next[bucket[i]]++;
+            sorted[slot * 2] = screen[i * 2];
+            sorted[slot * 2 + 1] = screen[i * 2 + 1];
+        }
+
+        for (int b = 0; b < ANGLE_STEPS; b++)
+        {
+            if (counts[b + 1] > counts[b])
+                gfx.stamps(stampFor(stampSize, b), counts[b + 1] - counts[b], sorted + counts[b] * 2);
+        }
+    }
+};
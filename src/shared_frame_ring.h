@@ -0,0 +1,346 @@
+#pragma once
+
+#ifndef _WIN32
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "render_backend.h"
+
+// Finished frames in a POSIX shared-memory ring, for a consumer process on
+// the same machine to read in place. The object named by shm_open holds a
+// RingHeader, then `slotCount` slots of a FrameHeader followed by the frame's
+// pixels (0xAARRGGBB, rows top to bottom). Frame n (counted from 1) goes in
+// slot (n - 1) % slotCount.
+//
+// One producer and one consumer. The producer bumps `published` after each
+// frame; the consumer reads frame consumed + 1 straight out of the mapping
+// and then bumps `consumed`. A slot's sequence is 0 while the producer is
+// writing it and the frame number once it is complete, so a consumer that
+// was overtaken mid-read sees the number change and drops the frame.
+namespace SharedRing
+{
+static constexpr std::uint32_t MAGIC = 0x45455254; // "TREE"
+static constexpr std::uint32_t VERSION = 1;
+
+// What the producer does when the consumer still has every slot unread
+enum Policy : std::int32_t
+{
+    DROP_OLDEST, // overwrite the oldest unread frame; the consumer skips ahead
+    BLOCK        // wait for the consumer (only while one is attached)
+};
+
+struct RingHeader
+{
+    std::atomic<std::uint32_t> magic; // set last, once the rest is filled in
+    std::uint32_t version;
+    std::int32_t width, height;
+    std::int32_t slotCount;
+    std::int32_t policy;
+    std::uint64_t slotBytes; // from one slot's FrameHeader to the next
+    std::atomic<std::uint64_t> published;
+    std::atomic<std::uint64_t> consumed;
+    std::atomic<std::uint32_t> consumerAttached;
+    std::atomic<std::uint32_t> producerDone;
+};
+
+struct FrameHeader
+{
+    std::atomic<std::uint64_t> sequence; // frame number, 0 while being written
+    std::int32_t phase;                  // animationPhase of the frame
+    std::int32_t width, height;
+    std::int64_t timestampNs; // steady clock (CLOCK_MONOTONIC) when it was published
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "the ring needs lock-free 64-bit atomics to be shared between processes");
+
+static const size_t FRAME_HEADER_BYTES = 64; // pixels start cache-line aligned
+static_assert(sizeof(FrameHeader) <= FRAME_HEADER_BYTES, "frame header outgrew its room");
+
+// A blocking producer gives up on a consumer that has not read anything for
+// this long (it was most likely killed) and carries on as if none were there
+static constexpr double CONSUMER_TIMEOUT = 2.0;
+
+inline size_t headerBytes() { return (sizeof(RingHeader) + 63) / 64 * 64; }
+inline size_t slotBytes(int width, int height) { return FRAME_HEADER_BYTES + static_cast<size_t>(width) * height * sizeof(Color); }
+
+inline std::int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+} // namespace SharedRing
+
+// Producer side, owned by the renderer. open() creates the shared-memory
+// object and close() unlinks it; a consumer that has it mapped keeps
+// reading until it lets go. An object of the same name is left alone (it
+// may be another producer's ring) unless open() is told to replace it.
+class SharedFrameRing
+{
+private:
+    std::string name;
+    void *mapping = nullptr;
+    size_t mappedBytes = 0;
+    SharedRing::RingHeader *header = nullptr;
+    SharedRing::Policy policy = SharedRing::DROP_OLDEST;
+    long long overwritten = 0; // frames the consumer never got to
+    long long stalls = 0;      // publishes that waited for the consumer
+
+    SharedRing::FrameHeader *slot(std::uint64_t frame) const
+    {
+        char *base = static_cast<char *>(mapping) + SharedRing::headerBytes();
+        return reinterpret_cast<SharedRing::FrameHeader *>(base + ((frame - 1) % header->slotCount) * header->slotBytes);
+    }
+
+public:
+    SharedFrameRing() = default;
+    SharedFrameRing(const SharedFrameRing &) = delete;
+    SharedFrameRing &operator=(const SharedFrameRing &) = delete;
+    ~SharedFrameRing() { close(); }
+
+    // Returns false with errno set if the object cannot be created or mapped,
+    // EEXIST if one of that name is there and `replace` is not set
+    bool open(const char *ringName, int width, int height, int slots, SharedRing::Policy slowConsumer, bool replace = false)
+    {
+        close();
+        name = ringName;
+        policy = slowConsumer;
+        mappedBytes = SharedRing::headerBytes() + SharedRing::slotBytes(width, height) * slots;
+
+        int fd = shm_open(ringName, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 && errno == EEXIST && replace)
+        {
+            shm_unlink(ringName);
+            fd = shm_open(ringName, O_CREAT | O_EXCL | O_RDWR, 0600);
+        }
+        if (fd < 0)
+            return false;
+        if (ftruncate(fd, static_cast<off_t>(mappedBytes)) != 0)
+        {
+            int error = errno;
+            ::close(fd);
+            shm_unlink(ringName);
+            errno = error;
+            return false;
+        }
+        mapping = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            int error = errno;
+            mapping = nullptr;
+            shm_unlink(ringName);
+            errno = error;
+            return false;
+        }
+
+        // A fresh object is zero-filled, which is every atomic's starting value
+        header = static_cast<SharedRing::RingHeader *>(mapping);
+        header->version = SharedRing::VERSION;
+        header->width = width;
+        header->height = height;
+        header->slotCount = slots;
+        header->policy = slowConsumer;
+        header->slotBytes = SharedRing::slotBytes(width, height);
+        header->magic.store(SharedRing::MAGIC, std::memory_order_release);
+        return true;
+    }
+
+    void close()
+    {
+        if (!mapping)
+            return;
+        header->producerDone.store(1, std::memory_order_release);
+        munmap(mapping, mappedBytes);
+        shm_unlink(name.c_str());
+        mapping = nullptr;
+        header = nullptr;
+    }
+
+    bool isOpen() const { return mapping != nullptr; }
+
+    // Copy a finished frame into the next slot and publish it
+    void publish(const Color *pixels, int phase)
+    {
+        std::uint64_t frame = header->published.load(std::memory_order_relaxed) + 1;
+        std::uint64_t slots = static_cast<std::uint64_t>(header->slotCount);
+        std::uint64_t consumed = header->consumed.load(std::memory_order_acquire);
+        if (frame - consumed > slots && header->consumerAttached.load(std::memory_order_acquire))
+        {
+            if (policy == SharedRing::BLOCK)
+            {
+                stalls++;
+                auto waitStart = std::chrono::steady_clock::now();
+                while (frame - header->consumed.load(std::memory_order_acquire) > slots && header->consumerAttached.load(std::memory_order_acquire))
+                {
+                    if (std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count() > SharedRing::CONSUMER_TIMEOUT)
+                    {
+                        header->consumerAttached.store(0, std::memory_order_release);
+                        break;
+                    }
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+            }
+            else
+            {
+                overwritten++;
+            }
+        }
+
+        SharedRing::FrameHeader *target = slot(frame);
+        target->sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(reinterpret_cast<char *>(target) + SharedRing::FRAME_HEADER_BYTES, pixels,
+                    static_cast<size_t>(header->width) * header->height * sizeof(Color));
+        target->phase = phase;
+        target->width = header->width;
+        target->height = header->height;
+        target->timestampNs = SharedRing::nowNs();
+        target->sequence.store(frame, std::memory_order_release);
+        header->published.store(frame, std::memory_order_release);
+    }
+
+    long long getPublished() const { return header ? static_cast<long long>(header->published.load(std::memory_order_relaxed)) : 0; }
+    long long getOverwritten() const { return overwritten; }
+    long long getStalls() const { return stalls; }
+};
+
+// Consumer side: maps an existing ring and hands out its frames in order,
+// in place. Call next() for a frame, read it, then release() it.
+class SharedFrameRingReader
+{
+private:
+    void *mapping = nullptr;
+    size_t mappedBytes = 0;
+    SharedRing::RingHeader *header = nullptr;
+    long long skipped = 0; // overwritten before they were read
+    long long torn = 0;    // overwritten while they were being read
+
+    const SharedRing::FrameHeader *slot(std::uint64_t frame) const
+    {
+        const char *base = static_cast<const char *>(mapping) + SharedRing::headerBytes();
+        return reinterpret_cast<const SharedRing::FrameHeader *>(base + ((frame - 1) % header->slotCount) * header->slotBytes);
+    }
+
+public:
+    SharedFrameRingReader() = default;
+    SharedFrameRingReader(const SharedFrameRingReader &) = delete;
+    SharedFrameRingReader &operator=(const SharedFrameRingReader &) = delete;
+    ~SharedFrameRingReader() { close(); }
+
+    // False if there is no such ring (yet), with errno set, or it is not one of ours
+    bool open(const char *ringName)
+    {
+        close();
+        int fd = shm_open(ringName, O_RDWR, 0);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < SharedRing::headerBytes())
+        {
+            ::close(fd);
+            errno = EAGAIN; // created but not sized yet
+            return false;
+        }
+        mappedBytes = static_cast<size_t>(info.st_size);
+        mapping = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            mapping = nullptr;
+            return false;
+        }
+        header = static_cast<SharedRing::RingHeader *>(mapping);
+        if (header->magic.load(std::memory_order_acquire) != SharedRing::MAGIC || header->version != SharedRing::VERSION ||
+            mappedBytes < SharedRing::headerBytes() + header->slotBytes * header->slotCount)
+        {
+            close();
+            errno = EINVAL;
+            return false;
+        }
+        // Start from the newest frame, not from whatever the ring held before
+        std::uint64_t published = header->published.load(std::memory_order_acquire);
+        header->consumed.store(published > 0 ? published - 1 : 0, std::memory_order_release);
+        header->consumerAttached.store(1, std::memory_order_release);
+        return true;
+    }
+
+    void close()
+    {
+        if (!mapping)
+            return;
+        header->consumerAttached.store(0, std::memory_order_release);
+        munmap(mapping, mappedBytes);
+        mapping = nullptr;
+        header = nullptr;
+    }
+
+    int getWidth() const { return header->width; }
+    int getHeight() const { return header->height; }
+    int getSlotCount() const { return header->slotCount; }
+    SharedRing::Policy getPolicy() const { return static_cast<SharedRing::Policy>(header->policy); }
+
+    // The producer has closed the ring and every frame it published has been read
+    bool isFinished() const
+    {
+        return header->producerDone.load(std::memory_order_acquire) &&
+               header->consumed.load(std::memory_order_relaxed) >= header->published.load(std::memory_order_acquire);
+    }
+
+    // The next unread frame, or nullptr if none is ready. Frames the producer
+    // has already overwritten are skipped.
+    const SharedRing::FrameHeader *next()
+    {
+        std::uint64_t published = header->published.load(std::memory_order_acquire);
+        std::uint64_t frame = header->consumed.load(std::memory_order_relaxed) + 1;
+        if (frame > published)
+            return nullptr;
+        std::uint64_t oldest = published > static_cast<std::uint64_t>(header->slotCount) ? published - header->slotCount + 1 : 1;
+        if (frame < oldest)
+        {
+            skipped += static_cast<long long>(oldest - frame);
+            frame = oldest;
+            header->consumed.store(frame - 1, std::memory_order_release);
+        }
+        const SharedRing::FrameHeader *current = slot(frame);
+        if (current->sequence.load(std::memory_order_acquire) != frame)
+        {
+            // Being overwritten already; try again from the newer frames
+            skipped++;
+            header->consumed.store(frame, std::memory_order_release);
+            return nullptr;
+        }
+        return current;
+    }
+
+    static const Color *pixels(const SharedRing::FrameHeader *frame)
+    {
+        return reinterpret_cast<const Color *>(reinterpret_cast<const char *>(frame) + SharedRing::FRAME_HEADER_BYTES);
+    }
+
+    // Done with the frame from next(). Returns false if the producer
+    // overwrote it meanwhile, in which case what was read is not to be trusted.
+    bool release(const SharedRing::FrameHeader *frame)
+    {
+        std::uint64_t expected = header->consumed.load(std::memory_order_relaxed) + 1;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        bool intact = frame->sequence.load(std::memory_order_relaxed) == expected;
+        torn += !intact;
+        header->consumed.store(expected, std::memory_order_release);
+        return intact;
+    }
+
+    long long getSkipped() const { return skipped; }
+    long long getTorn() const { return torn; }
+};
+
+#endif
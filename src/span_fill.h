@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+
+#include "render_backend.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SPAN_FILL_X86 1
+#endif
+
+// Writers for a horizontal run of identically coloured pixels, the inner loop
+// of every filled primitive. The vector versions are compiled with per-function
+// target attributes so the binary still runs on CPUs without them; the best
+// one is picked once at startup.
+enum class SpanFillKind
+{
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+using SpanFillFn = void (*)(Color *dst, int count, Color color);
+
+// Kept out of the auto-vectorizer so it is an honest baseline
+__attribute__((optimize("no-tree-vectorize"))) inline void fillSpanScalar(Color *dst, int count, Color color)
+{
+    for (int i = 0; i < count; i++)
+        dst[i] = color;
+}
+
+#ifdef SPAN_FILL_X86
+__attribute__((target("sse2"))) inline void fillSpanSSE2(Color *dst, int count, Color color)
+{
+    __m128i value = _mm_set1_epi32(static_cast<int>(color));
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), value);
+    for (; i < count; i++)
+        dst[i] = color;
+}
+
+__attribute__((target("avx2"))) inline void fillSpanAVX2(Color *dst, int count, Color color)
+{
+    __m256i value = _mm256_set1_epi32(static_cast<int>(color));
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), value);
+    if (i + 4 <= count)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm256_castsi256_si128(value));
+        i += 4;
+    }
+    for (; i < count; i++)
+        dst[i] = color;
+}
+#endif
+
+inline bool spanFillSupported(SpanFillKind kind)
+{
+    switch (kind)
+    {
+    case SpanFillKind::SCALAR:
+        return true;
+#ifdef SPAN_FILL_X86
+    case SpanFillKind::SSE2:
+        return __builtin_cpu_supports("sse2");
+    case SpanFillKind::AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+// Falls back to the scalar writer for kinds this CPU or build lacks
+inline SpanFillFn spanFillFunction(SpanFillKind kind)
+{
+    if (!spanFillSupported(kind))
+        return fillSpanScalar;
+#ifdef SPAN_FILL_X86
+    if (kind == SpanFillKind::AVX2)
+        return fillSpanAVX2;
+    if (kind == SpanFillKind::SSE2)
+        return fillSpanSSE2;
+#endif
+    return fillSpanScalar;
+}
+
+inline SpanFillKind bestSpanFill()
+{
+    static const SpanFillKind best = spanFillSupported(SpanFillKind::AVX2)   ? SpanFillKind::AVX2
+                                     : spanFillSupported(SpanFillKind::SSE2) ? SpanFillKind::SSE2
+                                                                             : SpanFillKind::SCALAR;
+    return best;
+}
+
+inline const char *spanFillName(SpanFillKind kind)
+{
+    switch (kind)
+    {
+    case SpanFillKind::SSE2:
+        return "sse2";
+    case SpanFillKind::AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
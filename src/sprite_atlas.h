@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include "rasterizer.h"
+#include "render_backend.h"
+#include "seed_particles.h"
+#include "trig_tables.h"
+
+// Pre-rasterized flowers, leaves and seeds, drawn with RenderBackend::stamps
+// instead of being rasterized again every time. Flowers and leaves depend
+// only on their integer size, so their stamps give exactly the pixels the
+// geometry would. Seeds also turn, so they are kept at SEED_ANGLE_STEPS
+// rotations and drawn at the nearest one; angle 0 is one of them, so the
+// seed in the ground is exact too. Everything is built up front by build().
+class SpriteAtlas
+{
+public:
+    static const int MAX_PETAL_SIZE = 8;    // flowers drawFlower makes up to scale 2
+    static const int MAX_LEAF_SIZE = 8;     // round leaves on the branches
+    static const int MAX_SEEDLING_LEAF = 20; // the seedling's two oval leaves
+    static const int MAX_SEED_SIZE = 32;    // seeds up to scale 4; bigger ones are drawn as geometry
+    static const int SEED_ANGLE_STEPS = 64;
+
+    struct Colors
+    {
+        Color petal, flowerCentre, leaf, seed, seedLine;
+    };
+
+private:
+    Colors colors;
+    std::vector<Stamp> flowers;        // by petal size
+    std::vector<Stamp> leaves;         // by radius
+    std::vector<Stamp> seedlingLeaves; // by horizontal radius
+    std::vector<Stamp> seeds;          // [(size - 1) * SEED_ANGLE_STEPS + step]
+    bool built = false;
+
+    // Room around an anchor for a shape reaching `reach` pixels from it
+    template <typename F>
+    static Stamp capture(int reach, F draw)
+    {
+        int extent = reach * 2 + 3;
+        return Rasterizer::captureStamp(extent, extent, extent / 2, extent / 2, [&](Rasterizer &raster) { draw(raster, extent / 2); });
+    }
+
+public:
+    explicit SpriteAtlas(const Colors &c) : colors(c) {}
+
+    void build()
+    {
+        if (built)
+            return;
+        for (int size = 0; size <= MAX_PETAL_SIZE; size++)
+        {
+            flowers.push_back(capture(size * 2 + 1, [&](Rasterizer &raster, int c) {
+                for (int i = 0; i < 5; i++)
+                {
+                    raster.fillEllipse(c + static_cast<int>(size * FLOWER_PETALS.cosines[i]), c + static_cast<int>(size * FLOWER_PETALS.sines[i]), size, size,
+                                       colors.petal);
+                }
+                raster.fillEllipse(c, c, size - 1, size - 1, colors.flowerCentre);
+            }));
+        }
+        for (int size = 0; size <= MAX_LEAF_SIZE; size++)
+            leaves.push_back(capture(size + 1, [&](Rasterizer &raster, int c) { raster.fillEllipse(c, c, size, size, colors.leaf); }));
+        for (int size = 0; size <= MAX_SEEDLING_LEAF; size++)
+        {
+            seedlingLeaves.push_back(capture(size + 1, [&](Rasterizer &raster, int c) {
+                raster.fillEllipse(c, c, size, static_cast<int>(size * 0.6), colors.leaf);
+            }));
+        }
+        for (int size = 1; size <= MAX_SEED_SIZE; size++)
+        {
+            for (int step = 0; step < SEED_ANGLE_STEPS; step++)
+            {
+                double angle = step * 2 * 3.14159 / SEED_ANGLE_STEPS;
+                seeds.push_back(capture(size + 1, [&](Rasterizer &raster, int c) {
+                    int points[24], line[4];
+                    seedShape(c, c, angle, size, points, line);
+                    raster.fillPoly(12, points, colors.seed, colors.seed);
+                    raster.line(line[0], line[1], line[2], line[3], 1, colors.seedLine);
+                }));
+            }
+        }
+        built = true;
+    }
+
+    // The stamp for that shape, or nullptr if the atlas does not hold it
+    const Stamp *flower(int petalSize) const
+    {
+        return built && petalSize >= 0 && petalSize <= MAX_PETAL_SIZE ? &flowers[petalSize] : nullptr;
+    }
+    const Stamp *leaf(int radius) const
+    {
+        return built && radius >= 0 && radius <= MAX_LEAF_SIZE ? &leaves[radius] : nullptr;
+    }
+    const Stamp *seedlingLeaf(int radius) const
+    {
+        return built && radius >= 0 && radius <= MAX_SEEDLING_LEAF ? &seedlingLeaves[radius] : nullptr;
+    }
+    // Seeds of this size are drawn with a 1-pixel line, as drawSeed does below scale 6
+    const Stamp *seed(int size, double angle) const
+    {
+        if (!built || size < 1 || size > MAX_SEED_SIZE)
+            return nullptr;
+        double turns = angle / (2 * 3.14159);
+        int step = static_cast<int>(std::lround((turns - std::floor(turns)) * SEED_ANGLE_STEPS)) % SEED_ANGLE_STEPS;
+        return &seeds[(size - 1) * SEED_ANGLE_STEPS + step];
+    }
+};
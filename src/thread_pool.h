@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join pool for short batches of independent integer tasks. Each
+// participant (the calling thread plus threadCount - 1 workers) owns a queue
+// that it pops from the back; when its own queue runs dry it steals from the
+// front of the others, so uneven tasks even out without a central queue.
+class WorkStealingPool
+{
+private:
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::vector<int> tasks;
+        size_t head = 0; // tasks before head have been stolen
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    const std::function<void(int, int)> *job = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    long long generation = 0;
+    int busyWorkers = 0;
+    bool stopping = false;
+    std::atomic<long long> stolenTasks{0};
+
+    bool popLocal(int participant, int &task)
+    {
+        WorkQueue &queue = *queues[participant];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.size() <= queue.head)
+            return false;
+        task = queue.tasks.back();
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(int thief, int &task)
+    {
+        int count = static_cast<int>(queues.size());
+        for (int k = 1; k < count; k++)
+        {
+            WorkQueue &victim = *queues[(thief + k) % count];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.tasks.size() > victim.head)
+            {
+                task = victim.tasks[victim.head++];
+                stolenTasks++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void drain(int participant)
+    {
+        int task;
+        while (popLocal(participant, task) || steal(participant, task))
+            (*job)(task, participant);
+    }
+
+    void workerLoop(int participant)
+    {
+        long long seen = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+
+            drain(participant);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busyWorkers == 0)
+                finished.notify_one();
+        }
+    }
+
+public:
+    explicit WorkStealingPool(int threadCount)
+    {
+        threadCount = std::max(1, threadCount);
+        for (int i = 0; i < threadCount; i++)
+            queues.push_back(std::make_unique<WorkQueue>());
+        for (int i = 1; i < threadCount; i++)
+            workers.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    int getThreadCount() const { return static_cast<int>(queues.size()); }
+    long long getStolenTasks() const { return stolenTasks; }
+
+    // Run fn(task, participant) for task in [0, taskCount) and wait for all of them.
+    // participant is in [0, getThreadCount()) and identifies the calling thread.
+    void run(int taskCount, const std::function<void(int, int)> &fn)
+    {
+        int count = static_cast<int>(queues.size());
+        for (int i = 0; i < count; i++)
+        {
+            queues[i]->tasks.clear();
+            queues[i]->head = 0;
+        }
+        for (int task = 0; task < taskCount; task++)
+            queues[task % count]->tasks.push_back(task);
+        job = &fn;
+
+        if (!workers.empty())
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busyWorkers = static_cast<int>(workers.size());
+            generation++;
+        }
+        wake.notify_all();
+
+        drain(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return busyWorkers == 0; });
+        job = nullptr;
+    }
+};
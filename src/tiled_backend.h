@@ -0,0 +1,103 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "command_buffer.h"
+#include "framebuffer_backend.h"
+#include "thread_pool.h"
+
+// Framebuffer backend that defers rasterization to the end of the frame.
+// Draw calls are recorded into a command buffer, binned into square screen
+// tiles by their bounds, and the tiles are rasterized in parallel by a
+// work-stealing pool. Each tile replays its commands in the original order
+// through its own clip rectangle, and the rasterizer computes spans
+// independently of the clip, so the result is pixel-identical to
+// FramebufferBackend.
+class TiledBackend : public FramebufferBackend
+{
+private:
+    CommandBuffer commands;
+    WorkStealingPool pool;
+    std::vector<Rasterizer> rasterizers; // one per pool participant
+    std::vector<std::vector<int>> tileCommands;
+    std::function<void(int, int)> rasterizeTile;
+    int tileSize;
+    int tilesX = 0, tilesY = 0;
+
+    void flush()
+    {
+        for (auto &tile : tileCommands)
+            tile.clear();
+
+        for (size_t i = 0; i < commands.size(); i++)
+        {
+            const ClipRect &box = commands[i].bounds;
+            int left = std::max(box.left, 0), top = std::max(box.top, 0);
+            int right = std::min(box.right, width), bottom = std::min(box.bottom, height);
+            if (left >= right || top >= bottom)
+                continue;
+            for (int ty = top / tileSize; ty <= (bottom - 1) / tileSize; ty++)
+                for (int tx = left / tileSize; tx <= (right - 1) / tileSize; tx++)
+                    tileCommands[ty * tilesX + tx].push_back(static_cast<int>(i));
+        }
+
+        pool.run(tilesX * tilesY, rasterizeTile);
+        commands.reset(width, height);
+    }
+
+public:
+    explicit TiledBackend(int threadCount, int tile = 64)
+        : pool(threadCount), tileSize(tile)
+    {
+        rasterizeTile = [this](int tile, int participant) {
+            Rasterizer &raster = rasterizers[participant];
+            int tx = tile % tilesX, ty = tile / tilesX;
+            raster.setClip({tx * tileSize, ty * tileSize, std::min((tx + 1) * tileSize, width), std::min((ty + 1) * tileSize, height)});
+            for (int i : tileCommands[tile])
+                commands.execute(i, raster);
+        };
+    }
+
+    void initialize(int w, int h, const char *title) override
+    {
+        FramebufferBackend::initialize(w, h, title);
+        rasterizers.assign(pool.getThreadCount(), Rasterizer());
+        for (auto &raster : rasterizers)
+            raster.setTarget(pixels.data(), w, h);
+        tilesX = (w + tileSize - 1) / tileSize;
+        tilesY = (h + tileSize - 1) / tileSize;
+        tileCommands.assign(tilesX * tilesY, std::vector<int>());
+        for (auto &tile : tileCommands)
+            tile.reserve(256); // bins only grow past this on unusually busy frames
+        commands.reset(w, h);
+    }
+
+    void endFrame() override
+    {
+        flush();
+        FramebufferBackend::endFrame();
+    }
+
+    // Recording has no pixels to cache between frames yet
+    bool supportsLayers() const override { return false; }
+
+    void clear() override { commands.clear(background); }
+    void line(int x1, int y1, int x2, int y2) override { commands.line(x1, y1, x2, y2, lineThickness, color); }
+    void lines(const LineSegment *segments, int count, bool antialias) override
+    {
+        if (count <= 0)
+            return;
+        commands.lines(segments, count, antialias);
+        color = segments[count - 1].color;
+        lineThickness = segments[count - 1].thickness;
+    }
+    void fillEllipse(int x, int y, int rx, int ry) override { commands.fillEllipse(x, y, rx, ry, fillColor); }
+    void fillPoly(int numPoints, const int *points) override { commands.fillPoly(numPoints, points, fillColor, color); }
+    void bar(int left, int top, int right, int bottom) override { commands.bar(left, top, right, bottom, fillColor); }
+    void text(int x, int y, const char *str) override { commands.text(x, y, str, textSize, color); }
+    void stamps(const Stamp &stamp, int count, const int *positions) override { commands.stamps(stamp, count, positions); }
+
+    int getThreadCount() const { return pool.getThreadCount(); }
+    long long getStolenTiles() const { return pool.getStolenTasks(); }
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "trig_tables.h"
+
+// A tree species as a one-rule parametric L-system:
+//
+//   B(l) -> F(l) [turn_1 B(l * f_1)] ... [turn_n B(l * f_n)]
+//
+// Every branch draws a segment of length l and ends in n children, child k
+// turned by turn_k and f_k times as long, down to `depth` levels. Levels are
+// counted up from the tips (1), so the wood/twig split, which levels carry
+// leaves and where flowers go are the same at any depth. BranchGeometry
+// expands a grammar into its flat segment stream once per growth step.
+struct TreeGrammar
+{
+    static constexpr int MAX_CHILDREN = 6;
+    static constexpr int MAX_DEPTH = 14;
+    static constexpr long long MAX_SEGMENTS = 4000000; // about 300 MB of geometry
+
+    struct Child
+    {
+        Direction turn;
+        double lengthFactor;
+    };
+
+    const char *name;
+    int childCount;
+    Child children[MAX_CHILDREN];
+    int depth;      // levels in the full tree
+    int twigLevels; // the top levels are green twigs, the rest brown wood
+    int leafLevels; // the top levels carry leaves
+
+    // Segments in the full tree at the given depth
+    long long segmentCount(int levels) const
+    {
+        long long total = 0, row = 1;
+        for (int level = 0; level < levels && total <= MAX_SEGMENTS; level++)
+        {
+            total += row;
+            row *= childCount;
+        }
+        return total;
+    }
+};
+
+constexpr TreeGrammar::Child branchChild(double angle, double lengthFactor)
+{
+    return {{constexprCos(angle), constexprSin(angle)}, lengthFactor};
+}
+
+// The tree the animation has always grown: children 0.3 rad to either side
+// at 0.7 of the length and one straight on at 0.7 * 0.8
+inline constexpr TreeGrammar OAK = {"oak", 3, {branchChild(-0.3, 0.7), branchChild(0.3, 0.7), branchChild(0.0, 0.7 * 0.8)}, 8, 4, 5};
+// A strong leader with short side shoots, tall and narrow
+inline constexpr TreeGrammar PINE = {"pine", 3, {branchChild(-1.0, 0.42), branchChild(1.0, 0.42), branchChild(0.0, 0.65)}, 10, 4, 5};
+// Forks in two, slightly lopsided, so it can go deep cheaply
+inline constexpr TreeGrammar BIRCH = {"birch", 2, {branchChild(-0.42, 0.68), branchChild(0.36, 0.7)}, 12, 5, 6};
+// Four wide children, low and dense
+inline constexpr TreeGrammar SHRUB = {"shrub", 4, {branchChild(-0.8, 0.62), branchChild(-0.25, 0.66), branchChild(0.25, 0.66), branchChild(0.8, 0.62)}, 7, 3, 4};
+
+inline constexpr const TreeGrammar *SPECIES[] = {&OAK, &PINE, &BIRCH, &SHRUB};
+
+inline const TreeGrammar *findSpecies(const char *name)
+{
+    for (const TreeGrammar *species : SPECIES)
+    {
+        if (std::strcmp(species->name, name) == 0)
+            return species;
+    }
+    return nullptr;
+}
+
+// Parse children written as "angle:factor,angle:factor,..." (angles in
+// radians, negative to the left) into `out`, which keeps its other fields.
+// Returns false, leaving `out` alone, if the text is not 1 to MAX_CHILDREN
+// such pairs with factors in (0, 1).
+inline bool parseGrammarRules(const char *text, TreeGrammar &out)
+{
+    TreeGrammar parsed = out;
+    parsed.childCount = 0;
+    const char *p = text;
+    while (*p)
+    {
+        char *end;
+        double angle = std::strtod(p, &end);
+        if (end == p || *end != ':')
+            return false;
+        p = end + 1;
+        double factor = std::strtod(p, &end);
+        if (end == p || factor <= 0 || factor >= 1 || parsed.childCount == TreeGrammar::MAX_CHILDREN)
+            return false;
+        parsed.children[parsed.childCount++] = {{std::cos(angle), std::sin(angle)}, factor};
+        p = end;
+        if (*p == ',' && p[1])
+            p++;
+        else if (*p)
+            return false; // anything else, or a comma with no rule after it
+    }
+    if (parsed.childCount == 0)
+        return false;
+    out = parsed;
+    return true;
+}
+
+// How BranchGeometry reads a grammar. FixedRules turns a species known at
+// compile time into constants, so the child loop unrolls with the turns and
+// length factors folded in; RuntimeRules reads one parsed from the command
+// line.
+template <const TreeGrammar &G>
+struct FixedRules
+{
+    static constexpr const TreeGrammar &grammar() { return G; }
+    static constexpr int childCount() { return G.childCount; }
+    static constexpr const TreeGrammar::Child &child(int k) { return G.children[k]; }
+};
+
+struct RuntimeRules
+{
+    const TreeGrammar &rules;
+
+    const TreeGrammar &grammar() const { return rules; }
+    int childCount() const { return rules.childCount; }
+    const TreeGrammar::Child &child(int k) const { return rules.children[k]; }
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+
+const int PHASE_COUNT = 6;
+
+inline const char *phaseName(int phase)
+{
+    static const char *names[PHASE_COUNT] = {"germination", "seedling", "growth", "flowering", "dispersal", "reset"};
+    return names[phase];
+}
+
+struct Seed
+{
+    double x, y;
+    double angle;
+    double velocityY;
+    bool active;
+};
+
+// Everything the fixed-timestep simulation advances. The renderer only ever
+// reads a copy of this, possibly blended between two consecutive ticks.
+struct TreeState
+{
+    long long tick = 0; // simulation ticks since start
+    int animationPhase = 0; // 0: germination, 1: seedling, 2: growth, 3: flowering, 4: seed fall, 5: reset
+    double phaseTimer = 0;  // advances by 2 per tick; fractional only in blended copies
+    double treeGrowthScale = 0.0;
+    double flowerScale = 0.0;
+    bool showFlowers = false;
+    double zoomScale = 1.0;
+    double cameraOffsetX = 0, cameraOffsetY = 0;
+    int seedX = 0, seedY = 0;
+    double sunAngle = 0.0; // for moving sun
+    std::vector<Seed> fallingSeeds;
+};
+
+// out = from + (to - from) * alpha for everything that moves continuously.
+// Across a phase change the two ticks are not comparable, so out is just `to`.
+inline void interpolateState(const TreeState &from, const TreeState &to, double alpha, TreeState &out)
+{
+    out = to;
+    if (from.animationPhase != to.animationPhase || alpha >= 1.0)
+        return;
+
+    auto lerp = [alpha](double a, double b) { return a + (b - a) * alpha; };
+    out.phaseTimer = lerp(from.phaseTimer, to.phaseTimer);
+    out.treeGrowthScale = lerp(from.treeGrowthScale, to.treeGrowthScale);
+    out.flowerScale = lerp(from.flowerScale, to.flowerScale);
+    out.zoomScale = lerp(from.zoomScale, to.zoomScale);
+    out.cameraOffsetX = lerp(from.cameraOffsetX, to.cameraOffsetX);
+    out.cameraOffsetY = lerp(from.cameraOffsetY, to.cameraOffsetY);
+
+    double sunDelta = to.sunAngle - from.sunAngle;
+    if (sunDelta < -3.14159)
+        sunDelta += 2 * 3.14159; // wrapped past a full turn
+    out.sunAngle = from.sunAngle + sunDelta * alpha;
+
+    if (from.fallingSeeds.size() == to.fallingSeeds.size())
+    {
+        for (size_t i = 0; i < to.fallingSeeds.size(); i++)
+        {
+            const Seed &a = from.fallingSeeds[i];
+            const Seed &b = to.fallingSeeds[i];
+            if (!a.active || !b.active)
+                continue;
+            out.fallingSeeds[i].x = lerp(a.x, b.x);
+            out.fallingSeeds[i].y = lerp(a.y, b.y);
+            out.fallingSeeds[i].angle = lerp(a.angle, b.angle);
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+// Sines and cosines the drawing code needs over and over, worked out at
+// compile time (std::sin is not constexpr, so these use their own series),
+// and the fixed rotation between a branch and its children.
+
+// sin and cos of x in radians, good to a few units in the last place: x is
+// brought into [-pi/4, pi/4] around the nearest quarter turn, and the Taylor
+// series there converges well before the last term
+constexpr double seriesSin(double r)
+{
+    double term = r, sum = r;
+    for (int n = 1; n < 12; n++)
+    {
+        term *= -r * r / ((2 * n) * (2 * n + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double seriesCos(double r)
+{
+    double term = 1.0, sum = 1.0;
+    for (int n = 1; n < 12; n++)
+    {
+        term *= -r * r / ((2 * n - 1) * (2 * n));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double constexprSin(double x)
+{
+    const double halfPi = 1.57079632679489661923;
+    double q = x / halfPi;
+    long long k = static_cast<long long>(q < 0 ? q - 0.5 : q + 0.5);
+    double r = x - static_cast<double>(k) * halfPi;
+    switch (((k % 4) + 4) % 4)
+    {
+    case 0:
+        return seriesSin(r);
+    case 1:
+        return seriesCos(r);
+    case 2:
+        return -seriesSin(r);
+    default:
+        return -seriesCos(r);
+    }
+}
+
+constexpr double constexprCos(double x) { return constexprSin(x + 1.57079632679489661923); }
+
+// Cosines and sines of the N angles i * 2 * 3.14159 / N, the way the petals,
+// seed outline and sun rays have always spaced them
+template <int N>
+struct CircleTable
+{
+    double cosines[N] = {};
+    double sines[N] = {};
+
+    constexpr CircleTable()
+    {
+        for (int i = 0; i < N; i++)
+        {
+            double angle = i * 2 * 3.14159 / N;
+            cosines[i] = constexprCos(angle);
+            sines[i] = constexprSin(angle);
+        }
+    }
+};
+
+inline constexpr CircleTable<5> FLOWER_PETALS;
+inline constexpr CircleTable<12> TWELVE_POINTS; // seed outline and sun rays
+
+// A direction as its cosine and sine. Turning by another direction adds the
+// angles, which is how branches get their children's directions without
+// calling cos and sin for each one.
+struct Direction
+{
+    double c, s;
+
+    constexpr Direction turned(const Direction &by) const { return {c * by.c - s * by.s, s * by.c + c * by.s}; }
+};
+
+// Children branch off 0.3 radians to either side of their parent
+inline constexpr Direction BRANCH_LEFT = {constexprCos(-0.3), constexprSin(-0.3)};
+inline constexpr Direction BRANCH_RIGHT = {constexprCos(0.3), constexprSin(0.3)};
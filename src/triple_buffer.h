@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+
+// Lock-free hand-off of the newest T from one producer thread to one
+// consumer thread. There are three slots: the producer fills its back slot
+// and publish()es it, which swaps it with the middle slot; the consumer's
+// acquire() swaps the middle slot for its front slot when something newer
+// was published. Neither side ever waits for the other. An item the consumer
+// did not get to before the next publish() is overwritten; it is counted in
+// getOverwritten().
+template <typename T>
+class TripleBuffer
+{
+private:
+    static const int FRESH = 4; // set in `middle` when it holds an item the consumer has not taken
+
+    T slots[3];
+    std::atomic<int> middle{1};
+    int back = 0;  // producer's slot
+    int front = 2; // consumer's slot
+    std::atomic<long long> published{0}, overwritten{0};
+
+public:
+    // Producer side: fill this, then publish() it
+    T &backSlot() { return slots[back]; }
+
+    void publish()
+    {
+        int old = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = old & 3;
+        published.fetch_add(1, std::memory_order_relaxed);
+        if (old & FRESH)
+            overwritten.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Consumer side: the newest published item, or nullptr if there has been
+    // none since the last call. It stays valid until the next acquire().
+    T *acquire()
+    {
+        if (!(middle.load(std::memory_order_acquire) & FRESH))
+            return nullptr;
+        int old = middle.exchange(front, std::memory_order_acq_rel);
+        front = old & 3;
+        return &slots[front];
+    }
+
+    long long getPublished() const { return published.load(std::memory_order_relaxed); }
+    long long getOverwritten() const { return overwritten.load(std::memory_order_relaxed); }
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// 2D affine map from world coordinates to screen pixels:
+//   screenX = a * x + c * y + tx
+//   screenY = b * x + d * y + ty
+// Geometry stays in float world coordinates until it is drawn and goes
+// through one of these on the way; map() rounds to the nearest pixel and is
+// the only place a position becomes an integer, so zooming in magnifies the
+// shape without magnifying truncation errors.
+class ViewTransform
+{
+public:
+    float a = 1.0f, b = 0.0f, c = 0.0f, d = 1.0f, tx = 0.0f, ty = 0.0f;
+
+    static ViewTransform translate(double x, double y)
+    {
+        ViewTransform t;
+        t.tx = static_cast<float>(x);
+        t.ty = static_cast<float>(y);
+        return t;
+    }
+
+    static ViewTransform scale(double s)
+    {
+        ViewTransform t;
+        t.a = t.d = static_cast<float>(s);
+        return t;
+    }
+
+    // The scene camera: shift by (offsetX, offsetY), then zoom by `zoom`
+    // about the point (centreX, centreY) of the screen
+    static ViewTransform zoomAbout(double zoom, double offsetX, double offsetY, double centreX, double centreY)
+    {
+        ViewTransform t = scale(zoom);
+        t.tx = static_cast<float>(offsetX * zoom - (zoom - 1.0) * centreX);
+        t.ty = static_cast<float>(offsetY * zoom - (zoom - 1.0) * centreY);
+        return t;
+    }
+
+    // The map that applies `inner` first and then this one
+    ViewTransform operator*(const ViewTransform &inner) const
+    {
+        ViewTransform t;
+        t.a = a * inner.a + c * inner.b;
+        t.b = b * inner.a + d * inner.b;
+        t.c = a * inner.c + c * inner.d;
+        t.d = b * inner.c + d * inner.d;
+        t.tx = a * inner.tx + c * inner.ty + tx;
+        t.ty = b * inner.tx + d * inner.ty + ty;
+        return t;
+    }
+
+    // Nearest pixel, ties to even
+    static int toPixel(float v)
+    {
+#ifdef __SSE2__
+        return _mm_cvtss_si32(_mm_set_ss(v));
+#else
+        return static_cast<int>(std::lrint(v));
+#endif
+    }
+
+    // One point, rounded to the pixel the batch version below gives it
+    void map(float x, float y, int &sx, int &sy) const
+    {
+        sx = toPixel(a * x + c * y + tx);
+        sy = toPixel(b * x + d * y + ty);
+    }
+
+    // n points from the arrays x and y into the pixel arrays sx and sy.
+    // Four at a time with SSE2; the products, sums and rounding are the same
+    // float operations, so every point lands exactly where map() puts it.
+    void map(const float *x, const float *y, size_t n, int *sx, int *sy) const
+    {
+        size_t i = 0;
+#ifdef __SSE2__
+        const __m128 va = _mm_set1_ps(a), vb = _mm_set1_ps(b), vc = _mm_set1_ps(c), vd = _mm_set1_ps(d);
+        const __m128 vtx = _mm_set1_ps(tx), vty = _mm_set1_ps(ty);
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i);
+            __m128 qx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(va, px), _mm_mul_ps(vc, py)), vtx);
+            __m128 qy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vb, px), _mm_mul_ps(vd, py)), vty);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(sx + i), _mm_cvtps_epi32(qx));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(sy + i), _mm_cvtps_epi32(qy));
+        }
+#endif
+        for (; i < n; i++)
+            map(x[i], y[i], sx[i], sy[i]);
+    }
+
+    // Pixel box covering the image of the world box [left, right] x [top, bottom],
+    // give or take a pixel outward (it is for culling)
+    void bounds(float left, float top, float right, float bottom, int &screenLeft, int &screenTop, int &screenRight, int &screenBottom) const
+    {
+        float cx = (left + right) * 0.5f, cy = (top + bottom) * 0.5f;
+        float hx = (right - left) * 0.5f, hy = (bottom - top) * 0.5f;
+        float mx = a * cx + c * cy + tx, my = b * cx + d * cy + ty;
+        float ex = std::fabs(a) * hx + std::fabs(c) * hy, ey = std::fabs(b) * hx + std::fabs(d) * hy;
+        screenLeft = static_cast<int>(mx - ex) - 1;
+        screenTop = static_cast<int>(my - ey) - 1;
+        screenRight = static_cast<int>(mx + ex) + 1;
+        screenBottom = static_cast<int>(my + ey) + 1;
+    }
+};
@@ -0,0 +1,103 @@
+// Reference consumer for run_headless --shm-ring: maps the ring, reads each
+// frame in place and prints its sequence number, phase, hash and how long
+// after publishing it was read, then a summary once the renderer is done.
+//
+//   ./run_headless --cycle --shm-ring /tree-frames --shm-policy block &
+//   ./frame_ring_consumer /tree-frames
+//
+// The hash is the one --golden uses (FNV-1a over each pixel's RGB), so frames
+// can be checked against tests/golden_frames.txt. --delay MS makes it a slow
+// consumer, to watch the producer's policy at work.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "../src/shared_frame_ring.h"
+
+static unsigned long long frameHash(const Color *pixels, size_t count)
+{
+    unsigned long long h = 14695981039346656037ull;
+    for (size_t i = 0; i < count; i++)
+        h = (h ^ (pixels[i] & 0xFFFFFF)) * 1099511628211ull;
+    return h;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *name = nullptr;
+    int delayMs = 0;
+    bool quiet = false, usage = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--delay") == 0 && i + 1 < argc)
+            delayMs = std::max(0, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--quiet") == 0)
+            quiet = true;
+        else if (!name && argv[i][0] != '-')
+            name = argv[i];
+        else
+            usage = true;
+    }
+    if (!name || usage)
+    {
+        std::fprintf(stderr, "Usage: %s NAME [--delay MS] [--quiet]\n"
+                             "  NAME        the ring run_headless --shm-ring was given, e.g. /tree-frames\n"
+                             "  --delay MS  wait MS after each frame, like a slow consumer\n"
+                             "  --quiet     print only the summary\n",
+                     argv[0]);
+        return 1;
+    }
+
+    // The renderer may not have created the ring yet
+    SharedFrameRingReader ring;
+    auto start = std::chrono::steady_clock::now();
+    while (!ring.open(name))
+    {
+        if (std::chrono::steady_clock::now() - start > std::chrono::seconds(10))
+        {
+            std::fprintf(stderr, "No shared-memory ring %s: %s\n", name, std::strerror(errno));
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::fprintf(stderr, "%s: %dx%d, %d slots, %s\n", name, ring.getWidth(), ring.getHeight(), ring.getSlotCount(),
+                 ring.getPolicy() == SharedRing::BLOCK ? "producer waits" : "oldest frame dropped");
+
+    size_t pixelCount = static_cast<size_t>(ring.getWidth()) * ring.getHeight();
+    long long frames = 0;
+    double latencyTotal = 0.0, latencyWorst = 0.0;
+    if (!quiet)
+        std::printf("%8s  %5s  %-16s  %10s\n", "sequence", "phase", "hash", "latency ms");
+    while (!ring.isFinished())
+    {
+        const SharedRing::FrameHeader *frame = ring.next();
+        if (!frame)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            continue;
+        }
+        unsigned long long sequence = frame->sequence.load(std::memory_order_relaxed);
+        int phase = frame->phase;
+        double latency = (SharedRing::nowNs() - frame->timestampNs) / 1e6;
+        unsigned long long hash = frameHash(SharedFrameRingReader::pixels(frame), pixelCount);
+        if (!ring.release(frame))
+            continue;
+
+        frames++;
+        latencyTotal += latency;
+        latencyWorst = std::max(latencyWorst, latency);
+        if (!quiet)
+            std::printf("%8llu  %5d  %016llx  %10.3f\n", sequence, phase, hash, latency);
+        if (delayMs > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+    }
+
+    std::fprintf(stderr, "read %lld frames, %lld overwritten before reading, %lld while reading; latency mean %.3f ms, worst %.3f ms\n",
+                 frames, ring.getSkipped(), ring.getTorn(), frames > 0 ? latencyTotal / frames : 0.0, latencyWorst);
+    return 0;
+}